@@ -9,18 +9,24 @@
 // Inodes start at block 2.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size, recorded in the super block
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint flags;        // FS_EXTENTS
+  uint bsize;        // Block size (BSIZE)
 };
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1  // files are mapped by extents, not block lists
+
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -29,9 +35,24 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data, indirect, double- and triple-indirect blocks
+};
+
+// On an FS_EXTENTS file system, addrs[] instead holds a file's
+// extents: runs of consecutive disk blocks, in file order.  The
+// first NIEXTENT are in the dinode; addrs[XINDEX] is an index
+// block listing blocks of NXEXTENT further extents each.  A run
+// of length 0 ends the list.
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks
 };
 
+#define NIEXTENT ((NDIRECT+2) / 2)
+#define XINDEX (NDIRECT+2)
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+#define MAXEXTENT (NIEXTENT + NINDIRECT*NXEXTENT)
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
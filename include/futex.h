@@ -0,0 +1,9 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+// Operations for the futex system call
+
+#define FUTEX_WAIT 0  // sleep if *addr still holds val
+#define FUTEX_WAKE 1  // wake up to val processes waiting on addr
+
+#endif // _FUTEX_H_
@@ -0,0 +1,46 @@
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+// Kernel performance counters, for use with the getkstat syscall.
+// Counters only ever grow (modulo 2^32); sample twice and subtract.
+
+struct kstat {
+  uint ticks;          // Clock ticks processed by the timer wheel
+  uint tickcycles;     // Cycles spent expiring timers (rdtsc)
+  uint timersleepers;  // Processes currently in sleep()
+  uint timerwakeups;   // Processes woken by an expired sleep()
+  uint kallocs;        // Pages allocated by kalloc()
+  uint kallochits;     // kalloc() calls served from a per-CPU cache
+  uint kfrees;         // Pages freed by kfree()
+  uint kmemlocks;      // Acquisitions of the global free-list lock
+  uint bcachebufs;     // Buffers in the disk block cache
+  uint bcachehits;     // Block lookups found in the cache
+  uint bcachemisses;   // Block lookups that had to claim a buffer
+  uint bcacheevicts;   // Cached blocks recycled for another block
+  uint dirtybufs;      // Buffers waiting to be written back
+  uint flushed;        // Buffers written back by bflush()
+  uint readaheads;     // Blocks read ahead of sequential file reads
+  uint readaheadhits;  // Read-ahead blocks later used
+  uint ballocs;        // Disk blocks put into use by files
+  uint bscans;         // Bitmap blocks examined by the block allocator
+  uint icacheinodes;   // Inodes allocated in the inode cache
+  uint icachehits;     // iget() calls that found the inode cached
+  uint icachemisses;   // iget() calls that had to take a fresh inode
+  uint icachereads;    // Inodes read from disk by ilock()
+  uint dcachehits;     // Name lookups answered by the name cache
+  uint dcachenegs;     // ... of which were for names that do not exist
+  uint dcachemisses;   // Name lookups that had to read the directory
+  uint pipeflips;      // Pages moved through pipes without copying
+  uint futexwaits;     // Sleeps in futex(FUTEX_WAIT)
+  uint futexwakes;     // Processes woken by futex(FUTEX_WAKE)
+  uint ideintrs;       // Disk interrupts handled
+  uint idecmds;        // Disk commands issued (after merging)
+  uint idesectors;     // Sectors transferred
+  uint idedmas;        // Disk commands done by bus-master DMA
+  uint idelate;        // Requests served out of order at their deadline
+  uint idebackseeks;   // Commands starting below the previous one
+  uint idesubmits;     // Requests queued for the disk
+  uint idedepthsum;    // Sum over requests of the queue depth they saw
+};
+
+#endif // _KSTAT_H_
@@ -8,8 +8,13 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define BCACHEDIV    16  // 1/BCACHEDIV of memory holds the disk block cache
+#define RAMIN         4  // initial read-ahead window, in blocks
+#define RAMAX        64  // maximum read-ahead window, in blocks
+#define ICACHEDIV    64  // at most 1/ICACHEDIV of memory holds cached i-nodes
+#define NDENTRY     256  // directory name cache entries
+#define NFSDEV        2  // maximum number of disks holding file systems
+#define NPREALLOC     8  // blocks reserved at a time for a growing file
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define USERTOP  0xA0000 // end of user address space
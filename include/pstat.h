@@ -13,6 +13,10 @@ struct pstat {
   int pass[NPROC];       // Current pass value of each process
   int scheduled[NPROC];  // Number of times each process has been shceduled
   int ticks[NPROC];      // Number of ticks each process has accumulated
+  int cpu[NPROC];        // CPU whose run queue each process last ran from
+  int migrated[NPROC];   // Number of times each process was stolen by another CPU
+  int size[NPROC];       // Bytes of address space each process has reserved
+  int resident[NPROC];   // Pages of it actually allocated (resident set size)
 };
 
 #endif // _PSTAT_H_
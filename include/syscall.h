@@ -28,4 +28,14 @@
 #define SYS_getpinfo  24
 #define SYS_clone     25
 #define SYS_join      26
+#define SYS_getkstat  27
+#define SYS_sync      28
+#define SYS_fsync     29
+#define SYS_biobench  30
+#define SYS_sendfile  31
+#define SYS_pread     32
+#define SYS_pwrite    33
+#define SYS_readv     34
+#define SYS_writev    35
+#define SYS_futex     36
 #endif // _SYSCALL_H_
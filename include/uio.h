@@ -0,0 +1,13 @@
+#ifndef _UIO_H_
+#define _UIO_H_
+
+// Buffers for the vectored readv and writev system calls.
+
+#define IOV_MAX 16  // max buffers per call
+
+struct iovec {
+  void *iov_base;
+  uint iov_len;
+};
+
+#endif // _UIO_H_
@@ -11,6 +11,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -32,6 +41,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -114,6 +129,15 @@ resp(void)
   return val;
 }
 
+// Low 32 bits of the time-stamp counter.
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
 static inline void
 cli(void)
 {
@@ -139,6 +163,40 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add delta to *addr and return the new value.
+static inline int
+atomic_add(volatile int *addr, int delta)
+{
+  int old = delta;
+
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (old), "+m" (*addr) :
+               :
+               "memory", "cc");
+  return old + delta;
+}
+
+// Atomically set *addr to newval if it holds old.
+// Return the value *addr held.
+static inline uint
+cmpxchg(volatile uint *addr, uint old, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (old) :
+               "memory", "cc");
+  return result;
+}
+
+// Tell the CPU we are in a spin-wait loop.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
 static inline void
 lcr0(uint val)
 {
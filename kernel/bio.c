@@ -1,95 +1,273 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
-// 
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to mark it dirty.
 // * When done with the buffer, call brelse.
+// * For a newly allocated block, call bzalloc instead of bread
+//     to get a zeroed buffer without reading the disk, and
+//     call bforget when a block is freed.
+// * To force dirty buffers to disk, call bflush.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
-// 
-// The implementation uses three state flags internally:
+//
+// Asynchronous interface, to keep several requests in flight:
+// * breadasync is like bread but only starts the read.
+// * bwriteasync starts writing a locked, dirty buffer now.
+// * bwait waits for the I/O started on a buffer, and
+//     bpoll says whether it has finished.  A buffer must
+//     not be released while its I/O is in flight.
+//
+// The implementation uses four state flags internally:
 // * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.  
+//     and has not been passed back to brelse.
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_REF: the buffer has been used since the eviction
+//     clock hand last passed it.
+// * B_ASYNC: the buffer is owned by the disk driver, which
+//     releases it when the I/O completes (see bprefetch).
+// * B_RAHEAD: the buffer was read ahead and has not been used yet.
+// * B_QUEUED: I/O on the buffer is in the disk queue or under way;
+//     the disk driver calls biodone when it completes.
+//
+// The cache is sized from memory at boot.  Cached blocks are found
+// through a hash of (dev, sector); each bucket has its own lock,
+// which protects the bucket's chain and the flags of idle buffers
+// on it, so lookups of different blocks on different CPUs do not
+// contend.  Only a miss takes bcache.lock, which serializes eviction:
+// a clock hand sweeps the ring of all buffers, giving recently used
+// ones a second chance, and recycles the first idle one it finds.
+// Lock order is bcache.lock, then a bucket lock; no one holds two
+// bucket locks at once.
+//
+// The cache is write-back: bwrite only marks a buffer dirty, and
+// the bflushd kernel process writes dirty buffers to disk every
+// FLUSHTICKS ticks, in sector order.  Dirty buffers are never
+// evicted.  Writers flush synchronously once more than 1/DIRTYDIV
+// of the buffers are dirty, as does a miss that finds no clean
+// buffer to recycle.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "x86.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
-struct {
+#define NBUCKET 256
+#define FLUSHBATCH 64   // buffers claimed per pass of bflush
+#define FLUSHTICKS 100  // ticks between background flushes
+#define DIRTYDIV 4
+#define BBENCHMAX 64    // deepest queue bbench will keep
+#define BHASH(dev, sector) \
+  (((((uint)(dev) << 24) ^ (uint)(sector)) * 2654435761U) >> 24)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+  uint hits;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;     // eviction
+  struct buf *hand;         // clock hand, on the ring through next
+  struct buf *ring;         // first buffer on the ring
+  int nbuf;
+  volatile int ndirty;      // updated with atomic_add
+  uint flushed;             // protected by flushlock
+  int flushing;             // a bflush is running; protected by flushlock
+  struct spinlock flushlock;
+  uint misses;
+  uint evictions;
+  volatile int readaheads;      // updated with atomic_add,
+  volatile int readaheadhits;   // from any bucket
+  struct bucket bucket[NBUCKET];
 } bcache;
 
 void
 binit(void)
 {
-  struct buf *b;
+  extern char end[];
+  struct buf *b, *buf;
+  char *mem;
+  int i, nb, nd;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.flushlock, "bflush");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  bcache.nbuf = (PHYSTOP - PGROUNDUP((uint)end)) / BCACHEDIV /
+                (sizeof(struct buf) + BSIZE);
+
+  // Carve buffer headers and data out of whole pages.  All buffers
+  // start out unused: on the clock ring but in no hash bucket.
+  b = buf = 0;
+  nb = nd = 0;
+  mem = 0;
+  for(i = 0; i < bcache.nbuf; i++){
+    if(nb == 0){
+      if((buf = (struct buf*)kalloc()) == 0)
+        break;
+      nb = PGSIZE / sizeof(struct buf);
+    }
+    if(nd == 0){
+      if((mem = kalloc()) == 0)
+        break;
+      nd = PGSIZE / BSIZE;
+    }
+    memset(buf, 0, sizeof(*buf));
+    buf->dev = -1;
+    buf->data = (uchar*)mem;
+    if(b == 0)
+      bcache.hand = buf;
+    else
+      b->next = buf;
+    b = buf;
+    buf++, nb--;
+    mem += BSIZE, nd--;
   }
+  if(b == 0)
+    panic("binit");
+  bcache.nbuf = i;
+  bcache.ring = bcache.hand;
+  b->next = bcache.hand;
+}
+
+// Look for the block in bucket bk.  Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint sector)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->sector == sector)
+      return b;
+  return 0;
+}
+
+// Advance the clock hand to a clean, idle buffer and take it out
+// of its hash bucket, giving buffers used since the last sweep a
+// second chance.  Caller holds bcache.lock, so no one else can
+// find or claim the returned buffer.  Returns 0 if every buffer
+// is busy or dirty.
+static struct buf*
+bevict(void)
+{
+  struct bucket *bk;
+  struct buf *b, **pp;
+  int n;
+
+  for(n = 0; n < 2*bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    if(b->dev == -1)
+      return b;
+    bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+    acquire(&bk->lock);
+    if(b->flags & (B_BUSY|B_DIRTY)){
+      release(&bk->lock);
+      continue;
+    }
+    if(b->flags & B_REF){
+      b->flags &= ~B_REF;
+      release(&bk->lock);
+      continue;
+    }
+    for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+      ;
+    *pp = b->hnext;
+    release(&bk->lock);
+    bcache.evictions++;
+    return b;
+  }
+  return 0;
 }
 
 // Look through buffer cache for sector on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
+// If nowait is set, return 0 instead if the block is cached.
 static struct buf*
-bget(uint dev, uint sector)
+bget(uint dev, uint sector, int nowait)
 {
+  struct bucket *bk;
   struct buf *b;
+  int evicting;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, sector)];
+  evicting = 0;
+  acquire(&bk->lock);
 
  loop:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
+  if((b = bfind(bk, dev, sector)) != 0){
+    if(evicting){
+      release(&bcache.lock);
+      evicting = 0;
+    }
+    if(nowait){
+      release(&bk->lock);
+      return 0;
+    }
+    if(!(b->flags & B_BUSY)){
+      b->flags |= B_BUSY|B_REF;
+      if(b->flags & B_RAHEAD){
+        b->flags &= ~B_RAHEAD;
+        atomic_add(&bcache.readaheadhits, 1);
       }
-      sleep(b, &bcache.lock);
-      goto loop;
+      bk->hits++;
+      release(&bk->lock);
+      return b;
     }
+    sleep(b, &bk->lock);
+    goto loop;
   }
 
-  // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
-    }
+  // Allocate fresh block.  Eviction needs other buckets' locks,
+  // so drop ours and look again once bcache.lock is held, in case
+  // someone else brought the block in meanwhile.
+  if(!evicting){
+    release(&bk->lock);
+    acquire(&bcache.lock);
+    evicting = 1;
+    acquire(&bk->lock);
+    goto loop;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  if((b = bevict()) == 0){
+    // Everything is dirty or in use: write back and try again.
+    release(&bcache.lock);
+    if(bflush() == 0)
+      panic("bget: no buffers");
+    evicting = 0;
+    acquire(&bk->lock);
+    goto loop;
+  }
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY|B_REF;
+  bcache.misses++;
+
+  acquire(&bk->lock);
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -98,41 +276,289 @@ bread(uint dev, uint sector)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, sector, 0);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Return a B_BUSY buf for the indicated disk sector, having
+// started to read its contents if they are not cached; call
+// bwait before using them.
+struct buf*
+breadasync(uint dev, uint sector)
+{
+  struct buf *b;
+
+  b = bget(dev, sector, 0);
+  if(!(b->flags & B_VALID))
+    idesubmit(b);
+  return b;
+}
+
+// Start writing b's contents to disk and return at once;
+// call bwait before brelse.  Must be locked.
+void
+bwriteasync(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwriteasync");
+  if(!(b->flags & B_DIRTY)){
+    b->flags |= B_DIRTY;
+    atomic_add(&bcache.ndirty, 1);
+  }
+  idesubmit(b);
+}
+
+// Wait for the I/O started on b by breadasync or bwriteasync.
+void
+bwait(struct buf *b)
+{
+  idewaitrw(b);
+}
+
+// Has the I/O started on b finished?
+int
+bpoll(struct buf *b)
+{
+  return idedone(b);
+}
+
+// Return a B_BUSY buf for the indicated disk sector filled with
+// zeros, without reading the disk: for newly allocated blocks,
+// whose old contents do not matter.  The buffer is dirty.
+struct buf*
+bzalloc(uint dev, uint sector)
+{
+  struct buf *b;
+
+  b = bget(dev, sector, 0);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  b->flags &= ~B_RAHEAD;
+  bwrite(b);
+  return b;
+}
+
+// The indicated disk sector has been freed: drop its cached
+// contents, if idle, so that a pending write-back is not wasted
+// on them.
+void
+bforget(uint dev, uint sector)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = &bcache.bucket[BHASH(dev, sector)];
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, sector)) != 0 && !(b->flags & B_BUSY)){
+    if(b->flags & B_DIRTY)
+      atomic_add(&bcache.ndirty, -1);
+    b->flags &= ~(B_VALID|B_DIRTY|B_RAHEAD);
+  }
+  release(&bk->lock);
+}
+
+// Start reading the indicated disk sector into the cache, unless
+// it is there already, and return without waiting.  The disk
+// interrupt releases the buffer when the read completes, and a
+// later bread() finds it cached (or waits for it to arrive).
+void
+bprefetch(uint dev, uint sector)
+{
+  struct buf *b;
+
+  if((b = bget(dev, sector, 1)) == 0)
+    return;
+  b->flags |= B_ASYNC|B_RAHEAD;
+  atomic_add(&bcache.readaheads, 1);
+  idesubmit(b);
+}
+
+// Mark b's contents as needing to be written to disk; bflush
+// writes them later.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if((b->flags & B_BUSY) == 0)
     panic("bwrite");
+  if(b->flags & B_DIRTY)
+    return;
   b->flags |= B_DIRTY;
-  iderw(b);
+  if(atomic_add(&bcache.ndirty, 1) > bcache.nbuf / DIRTYDIV)
+    bflush();
+}
+
+// Claim up to FLUSHBATCH dirty, idle buffers, starting at *bp on
+// the ring and stopping before end; advance *bp past them.
+static int
+bclaimdirty(struct buf **bp, struct buf *end, struct buf **batch)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int n;
+
+  n = 0;
+  acquire(&bcache.lock);
+  for(b = *bp; n < FLUSHBATCH; ){
+    if(b->dev != -1){
+      bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+      acquire(&bk->lock);
+      if((b->flags & (B_BUSY|B_DIRTY)) == B_DIRTY){
+        b->flags |= B_BUSY;
+        batch[n++] = b;
+      }
+      release(&bk->lock);
+    }
+    b = b->next;
+    if(b == end)
+      break;
+  }
+  release(&bcache.lock);
+  *bp = b;
+  return n;
+}
+
+// Write dirty buffers back to disk, a batch at a time: the whole
+// batch is queued in sector order, so the disk can merge and sweep,
+// then waited for.  Buffers in use are skipped: whoever holds one
+// will release it dirty, and a later flush writes it.  Flushes run
+// one at a time, so buffers skipped because another flush was
+// writing them are on disk before this one starts: when bflush
+// returns, every buffer that was dirty when it was called, and
+// not held by some process, has been written (see sys_sync).
+// Returns the number of buffers written.
+int
+bflush(void)
+{
+  struct buf *batch[FLUSHBATCH], *b, *t;
+  int i, j, n, total;
+
+  acquire(&bcache.flushlock);
+  while(bcache.flushing)
+    sleep(&bcache.flushing, &bcache.flushlock);
+  bcache.flushing = 1;
+  release(&bcache.flushlock);
+
+  total = 0;
+  b = bcache.ring;
+  do {
+    n = bclaimdirty(&b, bcache.ring, batch);
+
+    // Sort the batch by (dev, sector) so the disk sweeps once.
+    for(i = 1; i < n; i++){
+      t = batch[i];
+      for(j = i; j > 0 && (batch[j-1]->dev > t->dev ||
+          (batch[j-1]->dev == t->dev && batch[j-1]->sector > t->sector)); j--)
+        batch[j] = batch[j-1];
+      batch[j] = t;
+    }
+
+    for(i = 0; i < n; i++)
+      idesubmit(batch[i]);
+    for(i = 0; i < n; i++){
+      bwait(batch[i]);
+      brelse(batch[i]);
+    }
+    total += n;
+  } while(b != bcache.ring);
+
+  acquire(&bcache.flushlock);
+  bcache.flushed += total;
+  bcache.flushing = 0;
+  wakeup(&bcache.flushing);
+  release(&bcache.flushlock);
+  return total;
+}
+
+// Body of the bflushd kernel process.
+void
+bflushd(void)
+{
+  for(;;){
+    sleepticks(FLUSHTICKS);
+    bflush();
+  }
+}
+
+// Called by the disk driver, with its lock held, when the
+// I/O on b has completed: wake whoever waits for b, or
+// release it if no one is waiting.
+void
+biodone(struct buf *b)
+{
+  if(b->flags & B_DIRTY){
+    b->flags &= ~B_DIRTY;
+    atomic_add(&bcache.ndirty, -1);
+  }
+  b->flags |= B_VALID;
+  b->flags &= ~B_QUEUED;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    brelse(b);
+  } else
+    wakeup(b);
 }
 
 // Release the buffer b.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
-
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
-
+  bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+  acquire(&bk->lock);
   b->flags &= ~B_BUSY;
   wakeup(b);
+  release(&bk->lock);
+}
 
-  release(&bcache.lock);
+// Disk queue benchmark: read blocks 0..n-1 of dev, keeping up to
+// depth reads in flight.  Cached copies are ignored (clean ones are
+// re-read) so that every block goes to the disk.
+int
+bbench(uint dev, int n, int depth)
+{
+  struct buf *ring[BBENCHMAX], *b;
+  int i;
+
+  if(n < 0 || depth < 1 || depth > BBENCHMAX)
+    return -1;
+  for(i = 0; i < n + depth; i++){
+    if(i >= depth){
+      b = ring[i % depth];
+      bwait(b);
+      brelse(b);
+    }
+    if(i < n){
+      b = bget(dev, i, 0);
+      if(!(b->flags & B_DIRTY))
+        b->flags &= ~B_VALID;
+      if(!(b->flags & B_VALID))
+        idesubmit(b);
+      ring[i % depth] = b;
+    }
+  }
+  return 0;
 }
 
+// Fill in the buffer cache counters of ks.
+void
+bcachestats(struct kstat *ks)
+{
+  int i;
+
+  ks->bcachebufs = bcache.nbuf;
+  ks->bcachehits = 0;
+  for(i = 0; i < NBUCKET; i++)
+    ks->bcachehits += bcache.bucket[i].hits;
+  ks->bcachemisses = bcache.misses;
+  ks->bcacheevicts = bcache.evictions;
+  ks->dirtybufs = bcache.ndirty;
+  ks->flushed = bcache.flushed;
+  ks->readaheads = bcache.readaheads;
+  ks->readaheadhits = bcache.readaheadhits;
+}
@@ -5,13 +5,21 @@ struct buf {
   int flags;
   uint dev;
   uint sector;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  struct buf *qnext; // disk queue
-  uchar data[512];
+  struct buf *hnext; // hash chain of buffer cache bucket
+  struct buf *next;  // ring of all buffers, for eviction
+  struct buf *qnext; // disk queue, in arrival order; then running command
+  struct buf *qprev;
+  int qidx;          // index in the disk's sorted queue
+  uint qsweep;       // elevator sweep the request is served in
+  uint qtime;        // tick the request was queued
+  uchar *data;       // BSIZE bytes, in a page shared with other bufs
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_REF   0x8  // used since the eviction clock hand last passed
+#define B_ASYNC 0x10 // ideintr releases the buffer when I/O completes
+#define B_RAHEAD 0x20 // read ahead and not yet used
+#define B_QUEUED 0x40 // I/O submitted to the disk and not yet done
 
 #endif // _BUF_H_
@@ -5,17 +5,33 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
 struct pstat;
+struct kstat;
+struct pcidev;
+struct superblock;
 
 // bio.c
+void            bcachestats(struct kstat*);
+int             bbench(uint, int, int);
+int             bflush(void);
+void            bflushd(void);
+void            bforget(uint, uint);
 void            binit(void);
+void            biodone(struct buf*);
+void            bprefetch(uint, uint);
 struct buf*     bread(uint, uint);
+struct buf*     breadasync(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriteasync(struct buf*);
+void            bwait(struct buf*);
+struct buf*     bzalloc(uint, uint);
+int             bpoll(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -32,12 +48,18 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 int             dirlink(struct inode*, char*, uint);
+void            fsstats(struct kstat*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
+void            dcachestats(struct kstat*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(void);
@@ -50,13 +72,26 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readifn(struct inode*, uint, uint, int(*)(void*, char*, int), void*);
+void            readsb(int, struct superblock*);
+void            readahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writeifn(struct inode*, uint, uint, int(*)(void*, char*, int), void*);
+
+// futex.c
+int             futex(uint, int, int);
+void            futexinit(void);
+void            futexstats(struct kstat*);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+int             idedone(struct buf*);
+void            idewaitrw(struct buf*);
+void            idestats(struct kstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,8 +100,11 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+void            kallocstats(struct kstat*);
+void            kdup(char*);
 void            kfree(char*);
 void            kinit(void);
+int             krefcount(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -89,11 +127,20 @@ void            mpstartthem(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+int             pcifind(int, int, struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipeget(struct pipe*, char*, int);
+int             pipeput(struct pipe*, char*, int);
 int             piperead(struct pipe*, char*, int);
+int             pipewait(struct pipe*, int);
 int             pipewrite(struct pipe*, char*, int);
+void            pipestats(struct kstat*);
 
 // proc.c
 int             clone(void(*fcn)(void*), void *arg, void *stack);
@@ -101,16 +148,23 @@ struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             hasthreads(struct proc*);
 int             join(void **stack);
 int             kill(int);
+void            kproc(char*, void(*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+pde_t*          setuvm(pde_t*, uint);
 void            sleep(void*, struct spinlock*);
+int             sleepticks(uint);
+void            timerstats(struct kstat*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+void            wakeuptimers(uint);
 void            yield(void);
 void            getpstats(struct pstat*);
 
@@ -137,6 +191,7 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
+int             argoutptr(int, char**, int);
 int             argptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(struct proc*, uint, int*);
@@ -168,7 +223,13 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, int);
+int             uvmfault(pde_t*, uint, uint, int);
+int             uvmprefault(pde_t*, uint, uint, uint, int);
+int             residentuvm(pde_t*, uint);
+int             cowbreakuvm(pde_t*, uint);
+char*           uvmlend(pde_t*, uint, uint);
+int             uvmtake(pde_t*, uint, uint, char*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
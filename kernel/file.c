@@ -1,8 +1,10 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "file.h"
+#include "uio.h"
 #include "spinlock.h"
 
 struct devsw devsw[NDEV];
@@ -84,6 +86,34 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Sequential read-ahead.  If a read of n bytes at off carries on
+// where the last read of f stopped, double f's read-ahead window
+// (up to RAMAX blocks) and start reading that many blocks past the
+// end of this one; any other access collapses the window.
+// Caller must hold f->ip locked.
+static void
+filereadahead(struct file *f, uint off, uint n)
+{
+  uint end, start;
+
+  if(off == f->raoff){
+    f->rawin = f->rawin ? f->rawin * 2 : RAMIN;
+    if(f->rawin > RAMAX)
+      f->rawin = RAMAX;
+  } else
+    f->rawin = f->ranext = 0;
+  f->raoff = off + n;
+  if(f->rawin == 0)
+    return;
+
+  end = (off + n + BSIZE - 1) / BSIZE;  // first block not read
+  start = end > f->ranext ? end : f->ranext;
+  if(start < end + f->rawin){
+    readahead(f->ip, start, end + f->rawin - start);
+    f->ranext = end + f->rawin;
+  }
+}
+
 // Read from file f.  Addr is kernel address.
 int
 fileread(struct file *f, char *addr, int n)
@@ -96,8 +126,10 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      filereadahead(f, f->off, r);
       f->off += r;
+    }
     iunlock(f->ip);
     return r;
   }
@@ -124,3 +156,168 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Vectored and positional I/O.  Read into (or write from) the cnt
+// buffers of iov in turn, at offset off, or at f->off (advancing
+// it) if off is -1.  Addresses are kernel addresses.  An inode is
+// locked once for the whole vector, so the buffers are filled (or
+// written) as a unit with respect to other reads and writes of it.
+// Pipes have no offset; only the first buffer of a readv waits
+// for data.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+  tot = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < cnt; i++){
+      if(i == 0)
+        r = piperead(f->pipe, iov[i].iov_base, iov[i].iov_len);
+      else
+        r = pipeget(f->pipe, iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].iov_base, o, iov[i].iov_len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      o += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(tot > 0){
+      filereadahead(f, o - tot, tot);
+      if(off < 0)
+        f->off = o;
+    }
+    iunlock(f->ip);
+    return tot;
+  }
+  panic("filereadv");
+}
+
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->writable == 0)
+    return -1;
+  tot = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < cnt; i++){
+      if(pipewrite(f->pipe, iov[i].iov_base, iov[i].iov_len) < 0)
+        return -1;
+      tot += iov[i].iov_len;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < cnt; i++){
+      if((r = writei(f->ip, iov[i].iov_base, o, iov[i].iov_len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      o += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(tot > 0 && off < 0)
+      f->off = o;
+    iunlock(f->ip);
+    return tot;
+  }
+  panic("filewritev");
+}
+
+static int
+topipe(void *p, char *src, int n)
+{
+  return pipeput((struct pipe*)p, src, n);
+}
+
+static int
+frompipe(void *p, char *dst, int n)
+{
+  return pipeget((struct pipe*)p, dst, n);
+}
+
+// Move up to n bytes from in to out, where one is a file and
+// the other a pipe, straight between the buffer cache and the
+// pipe.  Off is the offset in the file, or -1 to use (and
+// advance) the file's own offset.  Returns the number of bytes
+// moved, which is short only at end of file (or of the pipe),
+// or -1.  The pipe is waited on with the inode unlocked, so a
+// reader of the pipe can use the file meanwhile.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  struct file *f;
+  struct pipe *p;
+  uint o;
+  int r, tot, done;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    f = in;
+    p = out->pipe;
+  } else if(in->type == FD_PIPE && out->type == FD_INODE){
+    f = out;
+    p = in->pipe;
+  } else
+    return -1;
+  if(f->ip->type == T_DEV)
+    return -1;
+
+  o = off < 0 ? f->off : off;
+  for(tot = 0, r = 0; tot < n; ){
+    if((r = pipewait(p, f == in)) <= 0)
+      break;
+    ilock(f->ip);
+    if(f == in){
+      if((r = readifn(f->ip, o, n - tot, topipe, p)) > 0)
+        filereadahead(f, o, r);
+      done = r < 0 || o + r >= f->ip->size;
+    } else {
+      r = writeifn(f->ip, o, n - tot, frompipe, p);
+      done = r <= 0;  // the pipe was drained, or bmap failed
+    }
+    if(r > 0){
+      tot += r;
+      o += r;
+      if(off < 0)
+        f->off = o;
+    }
+    iunlock(f->ip);
+    if(done)
+      break;
+  }
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
+}
@@ -8,6 +8,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // offset where the last read stopped
+  uint ranext; // first block not yet read ahead
+  uint rawin;  // read-ahead window, in blocks
 };
 
 
@@ -24,7 +27,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  uint pnext;         // next preallocated block, or goal for the next run
+  uint plen;          // preallocated blocks left, reserved in memory (see balloc)
+
+  uint xlblk;         // extent files: the run last looked up,
+  uint xstart;        // from file block xlblk at disk block xstart
+  uint xlen;          // for xlen blocks
+
+  struct inode *hnext;   // icache hash chain
+  struct inode *prev;    // icache LRU list, when ref is 0
+  struct inode *next;
 };
 
 #define I_BUSY 0x1
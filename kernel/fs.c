@@ -13,6 +13,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "x86.h"
 #include "stat.h"
 #include "mmu.h"
 #include "proc.h"
@@ -20,12 +21,17 @@
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "kstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define NRWBATCH 8  // blocks readi and writei keep in flight
 static void itrunc(struct inode*);
+static void iunreserve(struct inode*);
+static void dcacheinit(void);
+static void dcachepurge(uint, uint);
 
 // Read the super block.
-static void
+void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
@@ -33,67 +39,250 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize != BSIZE)
+    panic("readsb: wrong block size");
 }
 
-// Zero a block.
+// Zero a newly allocated block, in the cache only; the zeros
+// reach the disk with the next write-back (or are overwritten
+// first), and the old contents are never read.
 static void
 bzero(int dev, int bno)
 {
-  struct buf *bp;
-  
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  bwrite(bp);
-  brelse(bp);
+  brelse(bzalloc(dev, bno));
 }
 
 // Blocks. 
 
-// Allocate a disk block.
+// Per-device allocation state: a copy of the super block, a
+// next-fit hint, so that balloc neither rereads the super block
+// nor rescans the bitmap from block 0 on every allocation, and the
+// inodes holding runs of preallocated blocks (ip->pnext, ip->plen).
+// Preallocated blocks are reserved here, in memory only, and are
+// marked in the bitmap one at a time as they are put into a file,
+// so a crash cannot leak them.
+#define NRESV 32  // inodes per device holding preallocated blocks
+
+struct fsdev {
+  uint dev;
+  int valid;
+  uint hint;               // first block to try when there is no goal
+  struct superblock sb;
+  struct inode *resv[NRESV];
+};
+
+static struct {
+  struct spinlock lock;
+  struct fsdev dev[NFSDEV];
+  volatile int ballocs;    // updated with atomic_add
+  volatile int bscans;
+} fsdevs;
+
+// Return the allocation state for dev, reading its super block
+// the first time the device is seen.
+static struct fsdev*
+fsdev(uint dev)
+{
+  struct fsdev *d;
+  struct superblock sb;
+
+  acquire(&fsdevs.lock);
+  for(d = fsdevs.dev; d < &fsdevs.dev[NFSDEV]; d++)
+    if(d->valid && d->dev == dev){
+      release(&fsdevs.lock);
+      return d;
+    }
+  release(&fsdevs.lock);
+
+  readsb(dev, &sb);
+
+  acquire(&fsdevs.lock);
+  for(d = fsdevs.dev; d < &fsdevs.dev[NFSDEV]; d++)
+    if(d->valid && d->dev == dev)
+      goto found;
+  for(d = fsdevs.dev; d < &fsdevs.dev[NFSDEV]; d++)
+    if(!d->valid){
+      d->dev = dev;
+      d->sb = sb;
+      d->hint = 0;
+      d->valid = 1;
+      goto found;
+    }
+  panic("fsdev: too many devices");
+found:
+  release(&fsdevs.lock);
+  return d;
+}
+
+// Return d's reservation slot holding ip, or a free slot if ip
+// is 0, or 0 if there is none.  Caller holds fsdevs.lock.
+static struct inode**
+resvslot(struct fsdev *d, struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = d->resv; pp < &d->resv[NRESV]; pp++)
+    if(*pp == ip)
+      return pp;
+  return 0;
+}
+
+// If block b is preallocated to a file, return the end of its
+// run; otherwise return 0 and set *lim to the start of the next
+// preallocated run after b.  Caller holds fsdevs.lock.
+static uint
+reserved(struct fsdev *d, uint b, uint *lim)
+{
+  struct inode **pp, *ip;
+
+  *lim = d->sb.size;
+  for(pp = d->resv; pp < &d->resv[NRESV]; pp++){
+    if((ip = *pp) == 0)
+      continue;
+    if(b >= ip->pnext && b < ip->pnext + ip->plen)
+      return ip->pnext + ip->plen;
+    if(ip->pnext > b && ip->pnext < *lim)
+      *lim = ip->pnext;
+  }
+  return 0;
+}
+
+// Allocate a disk block for ip, at ip->pnext if it is free and
+// otherwise at the next free block after it (after the device
+// hint if ip->pnext is 0), and preallocate to ip up to NPREALLOC-1
+// free blocks following it.  A run never crosses a bitmap block.
+// Blocks preallocated to other files count as in use; all checks
+// and reservations are made with the bitmap block held, as btake
+// puts reserved blocks into use.  Ip must have none preallocated.
 static uint
-balloc(uint dev)
+balloc(struct inode *ip)
 {
-  int b, bi, m;
+  int bi, m;
+  uint b, i, start, len, end, lim;
   struct buf *bp;
-  struct superblock sb;
+  struct fsdev *d;
+  struct inode **pp;
 
+  d = fsdev(ip->dev);
+  start = ip->pnext;
+  if(start == 0 || start >= d->sb.size)
+    start = d->hint;
   bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
+  for(i = 0; i < d->sb.size; i++){
+    b = (start + i) % d->sb.size;
+    if(bp == 0 || bp->sector != BBLOCK(b, d->sb.ninodes)){
+      if(bp)
         brelse(bp);
-        return b + bi;
-      }
+      bp = bread(ip->dev, BBLOCK(b, d->sb.ninodes));
+      atomic_add(&fsdevs.bscans, 1);
+    }
+    bi = b % BPB;
+    if(bp->data[bi/8] == 0xff){  // Skip the rest of a full byte.
+      i += 7 - bi%8;
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if(bp->data[bi/8] & m)
+      continue;
+
+    acquire(&fsdevs.lock);
+    if((end = reserved(d, b, &lim)) != 0){
+      release(&fsdevs.lock);
+      i += end - b - 1;  // Skip another file's run.
+      continue;
+    }
+
+    // b is free: take it, and preallocate as many free blocks
+    // after it as are wanted and covered by this bitmap block.
+    bp->data[bi/8] |= m;  // Mark block in use on disk.
+    for(len = 1; len < NPREALLOC && b+len < lim && bi+len < BPB; len++){
+      m = 1 << ((bi+len) % 8);
+      if(bp->data[(bi+len)/8] & m)
+        break;
+    }
+    ip->pnext = b + 1;
+    ip->plen = 0;
+    if(len > 1 && (pp = resvslot(d, 0)) != 0){
+      *pp = ip;
+      ip->plen = len - 1;
     }
+    release(&fsdevs.lock);
+    bwrite(bp);
     brelse(bp);
+    d->hint = b + len;
+    atomic_add(&fsdevs.ballocs, 1);
+    return b;
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
-static void
-bfree(int dev, uint b)
+// Put the next of ip's preallocated blocks into use.  It is
+// marked in the bitmap before it leaves the reservation, with
+// the bitmap block held, so balloc never sees it free.
+static uint
+btake(struct inode *ip)
 {
   struct buf *bp;
-  struct superblock sb;
+  struct fsdev *d;
+  uint b;
   int bi, m;
 
-  bzero(dev, b);
-
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  d = fsdev(ip->dev);
+  b = ip->pnext;
+  bp = bread(ip->dev, BBLOCK(b, d->sb.ninodes));
   bi = b % BPB;
   m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;  // Mark block free on disk.
+  if(bp->data[bi/8] & m)
+    panic("btake: block in use");
+  bp->data[bi/8] |= m;  // Mark block in use on disk.
+  acquire(&fsdevs.lock);
+  ip->pnext++;
+  if(--ip->plen == 0)
+    *resvslot(d, ip) = 0;
+  release(&fsdevs.lock);
   bwrite(bp);
   brelse(bp);
+  atomic_add(&fsdevs.ballocs, 1);
+  return b;
+}
+
+// Mark n disk blocks starting at b free in the bitmap.
+static void
+bunmark(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  struct fsdev *d;
+  int bi, m;
+
+  d = fsdev(dev);
+  bp = 0;
+  for(; n > 0; b++, n--){
+    if(bp == 0 || bp->sector != BBLOCK(b, d->sb.ninodes)){
+      if(bp){
+        bwrite(bp);
+        brelse(bp);
+      }
+      bp = bread(dev, BBLOCK(b, d->sb.ninodes));
+    }
+    bi = b % BPB;
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;  // Mark block free on disk.
+  }
+  if(bp){
+    bwrite(bp);
+    brelse(bp);
+  }
+}
+
+// Free a disk block.  Only the bitmap is written: blocks are
+// zeroed when they are allocated again, not when freed.
+static void
+bfree(int dev, uint b)
+{
+  bforget(dev, b);
+  bunmark(dev, b, 1);
 }
 
 // Inodes.
@@ -128,20 +317,96 @@ bfree(int dev, uint b)
 // return pointers to *unlocked* inodes.  It is the callers'
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
+//
+// Cached inodes are found through a hash of (dev, inum).  An
+// inode whose ref drops to 0 stays hashed, with its contents, on
+// an LRU list, and is recycled for another inode only when there
+// are no never-used ones left.  The cache grows a page of inodes
+// at a time, up to 1/ICACHEDIV of memory.
+
+#define NIHASH 128
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;      // list head: unreferenced inodes, most recent first
+  struct inode *free;    // never-used inodes, through next
+  int ninode;            // inodes allocated
+  int max;               // limit on ninode
+  uint hits;
+  uint misses;
+  uint reads;            // inodes loaded from disk by ilock
 } icache;
 
 void
 iinit(void)
 {
+  extern char end[];
+
   initlock(&icache.lock, "icache");
+  icache.lru.prev = icache.lru.next = &icache.lru;
+  icache.max = (PHYSTOP - PGROUNDUP((uint)end)) / ICACHEDIV / sizeof(struct inode);
+  initlock(&fsdevs.lock, "fsdevs");
+  dcacheinit();
+}
+
+// Fill in the file system counters of ks.
+void
+fsstats(struct kstat *ks)
+{
+  ks->ballocs = fsdevs.ballocs;
+  ks->bscans = fsdevs.bscans;
+  acquire(&icache.lock);
+  ks->icacheinodes = icache.ninode;
+  ks->icachehits = icache.hits;
+  ks->icachemisses = icache.misses;
+  ks->icachereads = icache.reads;
+  release(&icache.lock);
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Add a page of never-used inodes to the cache.
+// Caller holds icache.lock.
+static void
+igrow(void)
+{
+  struct inode *ip;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return;
+  memset(mem, 0, PGSIZE);
+  for(ip = (struct inode*)mem; ip + 1 <= (struct inode*)(mem + PGSIZE); ip++){
+    ip->next = icache.free;
+    icache.free = ip;
+    icache.ninode++;
+  }
+}
+
+// Take ip off the LRU list.  Caller holds icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+}
+
+// Put ip on the LRU list, at the front if its contents are
+// worth keeping and at the back if not.  Caller holds icache.lock.
+static void
+lruinsert(struct inode *ip)
+{
+  struct inode *at;
+
+  at = (ip->flags & I_VALID) ? &icache.lru : icache.lru.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
 // Allocate a new inode with the given type on device dev.
 struct inode*
 ialloc(uint dev, short type)
@@ -149,10 +414,10 @@ ialloc(uint dev, short type)
   int inum;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
+  uint ninodes;
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
+  ninodes = fsdev(dev)->sb.ninodes;
+  for(inum = 1; inum < ninodes; inum++){  // loop over inode blocks
     bp = bread(dev, IBLOCK(inum));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -191,31 +456,47 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
+      icache.hits++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  }
+  icache.misses++;
+
+  // Allocate fresh inode: a never-used one, or failing that the
+  // least recently used unreferenced one.
+  if(icache.free == 0 && icache.ninode < icache.max)
+    igrow();
+  if((ip = icache.free) != 0)
+    icache.free = ip->next;
+  else {
+    ip = icache.lru.prev;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    lruremove(ip);
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->pnext = 0;
+  ip->plen = 0;
+  ip->xlen = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -249,6 +530,10 @@ ilock(struct inode *ip)
   release(&icache.lock);
 
   if(!(ip->flags & I_VALID)){
+    fsdev(ip->dev);  // check the super block on first use
+    acquire(&icache.lock);
+    icache.reads++;
+    release(&icache.lock);
     bp = bread(ip->dev, IBLOCK(ip->inum));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
@@ -278,24 +563,33 @@ iunlock(struct inode *ip)
 }
 
 // Caller holds reference to unlocked ip.  Drop reference.
+// Dropping the last reference returns any preallocated blocks.
 void
 iput(struct inode *ip)
 {
   acquire(&icache.lock);
-  if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
-    // inode is no longer used: truncate and free inode.
+  if(ip->ref == 1 && (ip->flags & I_VALID) && (ip->nlink == 0 || ip->plen > 0)){
     if(ip->flags & I_BUSY)
       panic("iput busy");
     ip->flags |= I_BUSY;
     release(&icache.lock);
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
+    iunreserve(ip);
+    if(ip->nlink == 0){
+      // inode is no longer used: truncate and free inode.
+      itrunc(ip);
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
+      ip->type = 0;
+      iupdate(ip);
+    }
     acquire(&icache.lock);
-    ip->flags = 0;
+    ip->flags &= ~I_BUSY;
+    if(ip->nlink == 0)
+      ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruinsert(ip);
   release(&icache.lock);
 }
 
@@ -312,38 +606,292 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT], the next NDINDIRECT
+// in the blocks listed in ip->addrs[NDIRECT+1], and the last
+// NTINDIRECT one level further down from ip->addrs[NDIRECT+2].
+// Index blocks are read through the buffer cache, so each level
+// costs a cache hit once the file is in use.
+
+// Allocate a zeroed data block for ip, right after the block it was
+// last given if possible.  Blocks are preallocated NPREALLOC at a
+// time so that a file written sequentially is laid out in runs
+// the disk queue can merge; iput returns the unused remainder.
+static uint
+iballoc(struct inode *ip)
+{
+  uint b;
+
+  if(ip->plen > 0)
+    b = btake(ip);
+  else
+    b = balloc(ip);
+  bzero(ip->dev, b);
+  return b;
+}
+
+// Give up ip's unused preallocated blocks.  They are reserved
+// only in memory and were never written, so nothing of them is
+// on disk or cached.
+static void
+iunreserve(struct inode *ip)
+{
+  struct fsdev *d;
+
+  if(ip->plen > 0){
+    d = fsdev(ip->dev);
+    acquire(&fsdevs.lock);
+    *resvslot(d, ip) = 0;
+    ip->plen = 0;
+    release(&fsdevs.lock);
+  }
+}
+
+// Extent-format inodes.
+
+// Return a pointer to the kth extent of ip, either in the dinode
+// copy or in the locked extent block *bpp (0 if in the dinode),
+// which the caller must release.  Missing extent blocks are
+// allocated if alloc is set; otherwise, and if k is beyond
+// MAXEXTENT, returns 0.
+static struct extent*
+xslot(struct inode *ip, uint k, int alloc, struct buf **bpp)
+{
+  struct buf *ibp;
+  uint addr, *a;
+
+  *bpp = 0;
+  if(k < NIEXTENT)
+    return (struct extent*)ip->addrs + k;
+  k -= NIEXTENT;
+  if(k / NXEXTENT >= NINDIRECT)
+    return 0;
+
+  if((addr = ip->addrs[XINDEX]) == 0){
+    if(!alloc)
+      return 0;
+    ip->addrs[XINDEX] = addr = iballoc(ip);
+  }
+  ibp = bread(ip->dev, addr);
+  a = (uint*)ibp->data;
+  if((addr = a[k / NXEXTENT]) == 0 && alloc){
+    a[k / NXEXTENT] = addr = iballoc(ip);
+    bwrite(ibp);
+  }
+  brelse(ibp);
+  if(addr == 0)
+    return 0;
+  *bpp = bread(ip->dev, addr);
+  return (struct extent*)(*bpp)->data + k % NXEXTENT;
+}
+
+// Look for the extent holding block bn of ip and remember it in
+// ip->x*.  Returns 0 if found; otherwise bn is past the end of
+// the file, which has *nx extents covering *nb blocks.
+static int
+xfind(struct inode *ip, uint bn, uint *nx, uint *nb)
+{
+  struct extent *x;
+  struct buf *bp, *ibp;
+  uint i, j, k, n, lblk, addr;
+  int found;
+
+  if(bn >= ip->xlblk && bn < ip->xlblk + ip->xlen)
+    return 0;
+
+  // Scan the dinode's extents, then each extent block in turn.
+  x = (struct extent*)ip->addrs;
+  n = NIEXTENT;
+  bp = ibp = 0;
+  found = 0;
+  lblk = k = i = 0;
+  for(;;){
+    for(j = 0; j < n && x[j].len; j++, k++){
+      if(bn < lblk + x[j].len){
+        ip->xlblk = lblk;
+        ip->xstart = x[j].start;
+        ip->xlen = x[j].len;
+        found = 1;
+        break;
+      }
+      lblk += x[j].len;
+    }
+    if(bp){
+      brelse(bp);
+      bp = 0;
+    }
+    if(found || j < n)
+      break;
+    if(ibp == 0){
+      if(ip->addrs[XINDEX] == 0)
+        break;
+      ibp = bread(ip->dev, ip->addrs[XINDEX]);
+    }
+    if(i == NINDIRECT || (addr = ((uint*)ibp->data)[i++]) == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    x = (struct extent*)bp->data;
+    n = NXEXTENT;
+  }
+  if(ibp)
+    brelse(ibp);
+  *nx = k;
+  *nb = lblk;
+  return found ? 0 : -1;
+}
+
+// bmap for extent-format inodes.  Files have no holes, so a
+// block not yet mapped is the next one; it is added to the last
+// extent if it follows it on disk, and starts a new one if not.
+// Returns 0 if the file has run out of extents.
+static uint
+xbmap(struct inode *ip, uint bn)
+{
+  struct extent *x;
+  struct buf *bp;
+  uint b, nx, nb;
+
+  if(xfind(ip, bn, &nx, &nb) == 0)
+    return ip->xstart + bn - ip->xlblk;
+  if(bn != nb)
+    panic("xbmap: hole");
+
+  if(nx > 0){
+    x = xslot(ip, nx-1, 0, &bp);
+    if(ip->plen == 0)
+      ip->pnext = x->start + x->len;  // try to extend the run
+    if(bp)
+      brelse(bp);
+  }
+  b = iballoc(ip);
+  if(nx > 0){
+    x = xslot(ip, nx-1, 0, &bp);
+    if(x->start + x->len == b){
+      x->len++;
+      goto done;
+    }
+    if(bp)
+      brelse(bp);
+  }
+  if((x = xslot(ip, nx, 1, &bp)) == 0){
+    bfree(ip->dev, b);
+    return 0;
+  }
+  x->start = b;
+  x->len = 1;
+done:
+  if(bp){
+    bwrite(bp);
+    brelse(bp);
+  }
+  ip->xlblk = bn - (b - x->start);
+  ip->xstart = x->start;
+  ip->xlen = x->len;
+  return b;
+}
+
+// Free all of an extent-format inode's blocks.
+static void
+xtrunc(struct inode *ip)
+{
+  struct extent *x;
+  struct buf *bp;
+  uint k, i, *a;
+
+  for(k = 0; (x = xslot(ip, k, 0, &bp)) != 0 && x->len != 0; k++){
+    for(i = 0; i < x->len; i++)
+      bforget(ip->dev, x->start + i);
+    bunmark(ip->dev, x->start, x->len);
+    if(bp)
+      brelse(bp);
+  }
+  if(bp)
+    brelse(bp);
+
+  if(ip->addrs[XINDEX]){
+    bp = bread(ip->dev, ip->addrs[XINDEX]);
+    a = (uint*)bp->data;
+    for(i = 0; i < NINDIRECT && a[i]; i++)
+      bfree(ip->dev, a[i]);
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[XINDEX]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->xlen = 0;
+}
+
+// Is dev's file system extent-format?
+static int
+isextent(uint dev)
+{
+  return fsdev(dev)->sb.flags & FS_EXTENTS;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one; it returns 0
+// if the file cannot grow.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, level, span;
   struct buf *bp;
 
+  if(isextent(ip->dev))
+    return xbmap(ip, bn);
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the tree that maps bn: ip->addrs[NDIRECT+level-1]
+  // is the root of level levels of index blocks, which map
+  // span blocks.
+  span = NINDIRECT;
+  for(level = 1; bn >= span; level++){
+    if(level == 3)
+      panic("bmap: out of range");
+    bn -= span;
+    span *= NINDIRECT;
+  }
+
+  // Walk down the tree, allocating index blocks if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = iballoc(ip);
+  for(; level > 0; level--){
+    span /= NINDIRECT;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      a[bn / span] = addr = iballoc(ip);
       bwrite(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= span;
   }
+  return addr;
+}
+
+// Free block addr, which is the root of level levels of
+// index blocks, and every block it maps.
+static void
+bfreetree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  if(level > 0){
+    bp = bread(dev, addr);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreetree(dev, a[j], level-1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -352,29 +900,19 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
+  if(isextent(ip->dev))
+    xtrunc(ip);
+  for(i = 0; i < NDIRECT+3; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfreetree(ip->dev, ip->addrs[i], i < NDIRECT ? 0 : i-NDIRECT+1);
       ip->addrs[i] = 0;
     }
   }
-  
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
 
+  iunreserve(ip);
+  ip->pnext = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -394,8 +932,9 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, o;
+  struct buf *bp, *batch[NRWBATCH];
+  int i, nb;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -408,21 +947,45 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+  // Start reading up to NRWBATCH blocks at once, so the disk
+  // can merge and overlap them, then copy each as it arrives.
+  for(tot=0; tot<n; ){
+    nb = 0;
+    for(o = off; o < off + (n - tot) && nb < NRWBATCH; o = (o/BSIZE + 1)*BSIZE)
+      batch[nb++] = breadasync(ip->dev, bmap(ip, o/BSIZE));
+    for(i = 0; i < nb; i++, tot+=m, off+=m, dst+=m){
+      bp = batch[i];
+      bwait(bp);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(dst, bp->data + off%BSIZE, m);
+      brelse(bp);
+    }
   }
   return n;
 }
 
+// Start reading n of ip's data blocks, from block bn on, into
+// the buffer cache without waiting for them (see fileread).
+// Caller must hold ip locked.
+void
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint nblocks;
+
+  if(ip->type == T_DEV)
+    return;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  for(; n > 0 && bn < nblocks; bn++, n--)
+    bprefetch(ip->dev, bmap(ip, bn));
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, o, addr;
+  struct buf *bp, *batch[NRWBATCH];
+  int i, nb;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -432,22 +995,108 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
-    n = MAXFILE*BSIZE - off;
+  // MAXFILE*BSIZE need not fit in a uint, so clamp in 64 bits.
+  if(n > 0 && (off + n - 1) / BSIZE >= MAXFILE)
+    n = (unsigned long long)(MAXFILE - off/BSIZE)*BSIZE - off%BSIZE;
+
+  // As in readi, start reading the blocks a batch at a time.
+  // Stop short if the file cannot grow any more.
+  for(tot=0; tot<n; ){
+    nb = 0;
+    for(o = off; o < off + (n - tot) && nb < NRWBATCH; o = (o/BSIZE + 1)*BSIZE){
+      if((addr = bmap(ip, o/BSIZE)) == 0){
+        n = o - off + tot;
+        break;
+      }
+      batch[nb++] = breadasync(ip->dev, addr);
+    }
+    for(i = 0; i < nb; i++, tot+=m, off+=m, src+=m){
+      bp = batch[i];
+      bwait(bp);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(bp->data + off%BSIZE, src, m);
+      bwrite(bp);
+      brelse(bp);
+    }
+  }
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+  if(n > 0 && off > ip->size){
+    ip->size = off;
+    iupdate(ip);
+  }
+  return n;
+}
+
+// Hand up to n bytes of ip's data from off on to fn(arg, data, m)
+// a block at a time, straight out of the buffer cache.  Fn returns
+// how many of the m bytes it took; a short count ends the walk.
+// Returns the number of bytes taken.  Used to move file data
+// without copying it through user memory (see filesend).
+// Caller must hold ip locked.
+int
+readifn(struct inode *ip, uint off, uint n, int (*fn)(void*, char*, int), void *arg)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(ip->type == T_DEV || off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; ){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    r = fn(arg, (char*)bp->data + off%BSIZE, m);
     brelse(bp);
+    if(r > 0){
+      tot += r;
+      off += r;
+    }
+    if(r < (int)m)
+      break;
   }
+  return tot;
+}
 
-  if(n > 0 && off > ip->size){
+// The other way round: have fn(arg, data, m) fill in up to n
+// bytes of ip from off on, growing the file as in writei.
+// Returns the number of bytes filled in.
+// Caller must hold ip locked.
+int
+writeifn(struct inode *ip, uint off, uint n, int (*fn)(void*, char*, int), void *arg)
+{
+  uint tot, m, addr;
+  int r;
+  struct buf *bp;
+
+  if(ip->type == T_DEV || off > ip->size || off + n < off)
+    return -1;
+  // MAXFILE*BSIZE need not fit in a uint, so clamp in 64 bits.
+  if(n > 0 && (off + n - 1) / BSIZE >= MAXFILE)
+    n = (unsigned long long)(MAXFILE - off/BSIZE)*BSIZE - off%BSIZE;
+
+  for(tot=0; tot<n; ){
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if((r = fn(arg, (char*)bp->data + off%BSIZE, m)) > 0){
+      bwrite(bp);
+      tot += r;
+      off += r;
+    }
+    brelse(bp);
+    if(r < (int)m)
+      break;
+  }
+
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot;
 }
 
 // Directories
@@ -458,6 +1107,167 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.  Maps (dev, directory inum, name) to the
+// inum and offset of the matching dirent, or records that there is
+// none (inum 0), so that repeated lookups need not read the
+// directory.  Entries are filled in by dirlookup and kept up to
+// date by dirlink and dirunlink, all with the directory locked;
+// namex reads the cache without locking the directory.  When a
+// directory is freed its entries are purged.  Least recently used
+// entries are recycled.
+struct dentry {
+  uint dev;
+  uint dir;            // inum of the directory
+  char name[DIRSIZ];
+  uint inum;           // 0: no such name
+  uint off;            // offset of the dirent, if inum != 0
+  struct dentry *hnext;
+  struct dentry *prev; // LRU list, most recent first
+  struct dentry *next;
+};
+
+#define NDHASH 64
+#define DHASH(dev, dir, name) (((dev)*31 + (dir)*17 + dnamehash(name)) % NDHASH)
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;   // list head
+  uint hits;
+  uint neghits;
+  uint misses;
+} dcache;
+
+static uint
+dnamehash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h;
+}
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = dcache.lru.next = &dcache.lru;
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    d->dev = -1;
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+// Move d to the front of the LRU list.  Caller holds dcache.lock.
+static void
+dtouch(struct dentry *d)
+{
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+}
+
+// Find the entry for name in directory dir.  Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[DHASH(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d out of its hash chain.  Caller holds dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->dev == -1)
+    return;
+  for(pp = &dcache.hash[DHASH(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dev = -1;
+}
+
+// Look up name in directory dir.  On a hit, returns 1 and sets
+// *ipp to a new reference to the named inode (0 if the name is
+// known not to exist) and *off to its dirent.  The reference is
+// taken before dcache.lock is released, so an unlink, which
+// updates the entry first, cannot free the inode in between.
+// Lock order: dcache.lock, then icache.lock.
+static int
+dcachelookup(uint dev, uint dir, char *name, struct inode **ipp, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dtouch(d);
+  *ipp = d->inum ? iget(dev, d->inum) : 0;
+  *off = d->off;
+  if(d->inum)
+    dcache.hits++;
+  else
+    dcache.neghits++;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp is inum, with its dirent at
+// off, or does not exist if inum is 0.  Caller holds dp locked.
+static void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.lru.prev;
+    dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = dcache.hash[DHASH(d->dev, d->dir, d->name)];
+    dcache.hash[DHASH(d->dev, d->dir, d->name)] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir, which is being freed.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++)
+    if(d->dev == dev && d->dir == dir)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
@@ -465,12 +1275,22 @@ struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
+  struct inode *ip;
   struct buf *bp;
   struct dirent *de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcachelookup(dp->dev, dp->inum, name, &ip, &off)){
+    if(ip && poff)
+      *poff = off;
+    return ip;
+  }
+  acquire(&dcache.lock);
+  dcache.misses++;
+  release(&dcache.lock);
+
   for(off = 0; off < dp->size; off += BSIZE){
     bp = bread(dp->dev, bmap(dp, off / BSIZE));
     for(de = (struct dirent*)bp->data;
@@ -480,15 +1300,18 @@ dirlookup(struct inode *dp, char *name, uint *poff)
         continue;
       if(namecmp(name, de->name) == 0){
         // entry matches path element
+        off += (uchar*)de - bp->data;
         if(poff)
-          *poff = off + (uchar*)de - bp->data;
+          *poff = off;
         inum = de->inum;
         brelse(bp);
+        dcacheenter(dp, name, inum, off);
         return iget(dp->dev, inum);
       }
     }
     brelse(bp);
   }
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -518,10 +1341,35 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheenter(dp, name, inum, off);
   
   return 0;
 }
 
+// Erase the directory entry for name, at offset off in dp.
+// Caller must have already locked dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink");
+  dcacheenter(dp, name, 0, 0);
+}
+
+// Fill in the name cache counters of ks.
+void
+dcachestats(struct kstat *ks)
+{
+  acquire(&dcache.lock);
+  ks->dcachehits = dcache.hits + dcache.neghits;
+  ks->dcachenegs = dcache.neghits;
+  ks->dcachemisses = dcache.misses;
+  release(&dcache.lock);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -568,6 +1416,7 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  uint off;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -575,6 +1424,16 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(proc->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // Only directories have cached entries, so a hit needs
+    // neither the lock on ip nor its contents.
+    if(!(nameiparent && *path == '\0') &&
+       dcachelookup(ip->dev, ip->inum, name, &next, &off)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -0,0 +1,122 @@
+// Futexes: let user code sleep until a word of its memory
+// changes.  FUTEX_WAIT checks that the word still holds the value
+// the caller last saw and sleeps; FUTEX_WAKE, called after the word
+// is changed, wakes sleepers.  The check is made under futexes.lock,
+// which FUTEX_WAKE also takes, so no wakeup is lost in between.
+//
+// A futex is named by (page table, address): threads, which share
+// a page table, meet on the same word, while unrelated processes
+// using the same address do not.  Each futex with sleepers has a
+// slot in futexes.q, on which they sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "kstat.h"
+#include "futex.h"
+
+struct futexq {
+  pde_t *pgdir;
+  uint addr;
+  int nwait;    // processes sleeping here; the slot is free when 0
+};
+
+static struct {
+  struct spinlock lock;
+  struct futexq q[NPROC];  // at most one per sleeping process
+  uint waits;
+  uint wakes;
+} futexes;
+
+void
+futexinit(void)
+{
+  initlock(&futexes.lock, "futex");
+}
+
+// Find the slot for addr in the current address space,
+// or, if alloc, a free one.  Caller must hold futexes.lock.
+static struct futexq*
+futexlookup(uint addr, int alloc)
+{
+  struct futexq *q, *free;
+
+  free = 0;
+  for(q = futexes.q; q < &futexes.q[NPROC]; q++){
+    if(q->nwait > 0 && q->pgdir == proc->pgdir && q->addr == addr)
+      return q;
+    if(q->nwait == 0 && free == 0)
+      free = q;
+  }
+  if(!alloc || free == 0)
+    return 0;
+  free->pgdir = proc->pgdir;
+  free->addr = addr;
+  return free;
+}
+
+// Sleep on addr if it holds val.  Returns 0 when woken (which
+// may be spuriously: callers must check the word again), or -1
+// if addr did not hold val or the process has been killed.
+static int
+futexwait(uint addr, int val)
+{
+  struct futexq *q;
+  int v;
+
+  acquire(&futexes.lock);
+  if(proc->killed || fetchint(proc, addr, &v) < 0 || v != val ||
+     (q = futexlookup(addr, 1)) == 0){
+    release(&futexes.lock);
+    return -1;
+  }
+  q->nwait++;
+  futexes.waits++;
+  sleep(q, &futexes.lock);
+  q->nwait--;
+  release(&futexes.lock);
+  return 0;
+}
+
+// Wake up to n processes sleeping on addr.
+// Returns the number woken.
+static int
+futexwake(uint addr, int n)
+{
+  struct futexq *q;
+  int woken;
+
+  woken = 0;
+  acquire(&futexes.lock);
+  if((q = futexlookup(addr, 0)) != 0)
+    woken = wakeupn(q, n);
+  futexes.wakes += woken;
+  release(&futexes.lock);
+  return woken;
+}
+
+int
+futex(uint addr, int op, int val)
+{
+  if(addr % 4 != 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
+
+// Fill in the futex counters of ks.
+void
+futexstats(struct kstat *ks)
+{
+  ks->futexwaits = futexes.waits;
+  ks->futexwakes = futexes.wakes;
+}
@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses the controller's bus-master DMA
+// when there is a PCI IDE controller that supports it (QEMU's
+// PIIX does), and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -8,7 +10,10 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "kstat.h"
+#include "pci.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -17,16 +22,73 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master registers, at idebm.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define SECTSIZE      512
+#define BSECT         (BSIZE/SECTSIZE)  // sectors per buf
+#define IDE_MAXSECT   16  // most sectors merged into one PIO command
+#define IDE_MAXDMA    128 // most sectors merged into one DMA command
+#define IDE_DEADLINE  50  // ticks a request may wait before it jumps the queue
+#define IDEQMAX       (PGSIZE / sizeof(struct buf*))
+
+// Physical region descriptor: one contiguous piece of a DMA transfer.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry of the table
+
+// Requests waiting for the disk are kept in C-SCAN (elevator) order
+// in ideheap, a binary min-heap ordered by (sweep, dev, sector): a
+// request for a sector at or past the disk head joins the current
+// sweep, one behind the head waits for the next.  So the head moves
+// steadily towards higher sectors, then returns to the lowest
+// request and starts again.  Waiting requests are also linked in
+// arrival order from idequeue through qnext/qprev; if the oldest has
+// waited IDE_DEADLINE ticks, it is served next regardless.
+//
+// idecur points to the bufs of the command now running, chained
+// through qnext in sector order: idestart merges requests for
+// adjacent sectors in the same direction into one command.  With
+// multiple mode the disk moves up to IDE_MAXSECT sectors per
+// interrupt; idexbuf and idexoff say where the next sector goes,
+// and idexleft how many remain.  With DMA the controller moves the
+// whole command straight to or from the bufs and interrupts once.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct buf **ideheap;
+static int idenq;
+static struct buf *idequeue, *idequeuetail;
+static uint idesweep;
+static uint idepos[2];  // sector after the last one transferred
+static struct buf *idecur;
+static struct buf *idexbuf;
+static int idexoff;
+static int idexleft;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static int idemult[2];  // sectors per interrupt, for each disk
+static ushort idebm;    // bus-master I/O base, or 0 to use PIO
+static struct prd *prdt;
+static uint nintr, ncmd, nsect, ndma, nlate, nback, nsubmit, ndepth;
+static void idestart(void);
+static void idecmd(struct buf*, int);
+static void idepio(int);
 
 // Wait for IDE disk to become ready.
 static int
@@ -41,12 +103,47 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk d to transfer IDE_MAXSECT sectors per interrupt,
+// falling back to one if it does not support multiple mode.
+static void
+idesetmult(int d)
+{
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f2, IDE_MAXSECT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idemult[d] = idewait(1) < 0 ? 1 : IDE_MAXSECT;
+}
+
+// Look for a PCI IDE controller capable of bus-master DMA and
+// set it up for the primary channel.  Leaves idebm 0 if none.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
+  uint bar;
+
+  if(pcifind(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) < 0)
+    return;
+  if(!(pciread(&d, PCI_CLASS) & 0x8000))  // prog if: bus master
+    return;
+  bar = pciread(&d, PCI_BAR(4));
+  if(!(bar & 1) || (bar & 0xfffc) == 0)
+    return;
+  if((prdt = (struct prd*)kalloc()) == 0)
+    return;
+  pciwrite(&d, PCI_COMMAND,
+           (pciread(&d, PCI_COMMAND) & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+  idebm = bar & 0xfffc;
+}
+
 void
 ideinit(void)
 {
   int i;
 
   initlock(&idelock, "ide");
+  if((ideheap = (struct buf**)kalloc()) == 0)
+    panic("ideinit");
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
@@ -60,29 +157,213 @@ ideinit(void)
     }
   }
   
+  idesetmult(0);
+  if(havedisk1)
+    idesetmult(1);
+  idedmainit();
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Does a go before b in the elevator order?
+static int
+ideless(struct buf *a, struct buf *b)
+{
+  if(a->qsweep != b->qsweep)
+    return (int)(a->qsweep - b->qsweep) < 0;
+  if(a->dev != b->dev)
+    return a->dev < b->dev;
+  return a->sector < b->sector;
+}
+
+static void
+heapset(int i, struct buf *b)
+{
+  ideheap[i] = b;
+  b->qidx = i;
+}
+
+// Restore the heap order around ideheap[i].
+static void
+heapfix(int i)
+{
+  struct buf *b;
+  int c;
+
+  b = ideheap[i];
+  for(; i > 0 && ideless(b, ideheap[(i-1)/2]); i = (i-1)/2)
+    heapset(i, ideheap[(i-1)/2]);
+  for(; (c = 2*i+1) < idenq; i = c){
+    if(c+1 < idenq && ideless(ideheap[c+1], ideheap[c]))
+      c++;
+    if(!ideless(ideheap[c], b))
+      break;
+    heapset(i, ideheap[c]);
+  }
+  heapset(i, b);
+}
+
+// Add b to the waiting requests.
+static void
+idequeueadd(struct buf *b)
+{
+  uint pos;
+
+  pos = idepos[b->dev & 1];
+  b->qsweep = b->sector * BSECT >= pos ? idesweep : idesweep + 1;
+  b->qtime = ticks;
+  heapset(idenq++, b);
+  heapfix(b->qidx);
+
+  b->qnext = 0;
+  b->qprev = idequeuetail;
+  if(idequeuetail)
+    idequeuetail->qnext = b;
+  else
+    idequeue = b;
+  idequeuetail = b;
+}
+
+// Take b out of the waiting requests.
+static void
+idequeuedel(struct buf *b)
+{
+  if(idenq == IDEQMAX)
+    wakeup(&idenq);
+  if(--idenq > b->qidx){
+    heapset(b->qidx, ideheap[idenq]);
+    heapfix(b->qidx);
+  }
+  if(b->qprev)
+    b->qprev->qnext = b->qnext;
+  else
+    idequeue = b->qnext;
+  if(b->qnext)
+    b->qnext->qprev = b->qprev;
+  else
+    idequeuetail = b->qprev;
+  b->qnext = 0;
+}
+
+// Start the next request in elevator order (or the oldest one, if
+// it is overdue), merged with the requests for the following
+// sectors in the same direction.  Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
+  struct buf *b, *first, *last;
+  int n, write, max;
+
+  if(idenq == 0)
     panic("idestart");
+  first = ideheap[0];
+  if(ticks - idequeue->qtime >= IDE_DEADLINE && idequeue != first){
+    first = idequeue;
+    nlate++;
+  }
+  idequeuedel(first);
+  if((int)(first->qsweep - idesweep) > 0)
+    idesweep = first->qsweep;
+  write = first->flags & B_DIRTY;
+
+  max = idebm ? IDE_MAXDMA : IDE_MAXSECT;
+  last = first;
+  for(n = BSECT; idenq > 0 && n + BSECT <= max; n += BSECT){
+    b = ideheap[0];
+    if(b->dev != first->dev || (b->flags & B_DIRTY) != write ||
+       b->sector != last->sector + 1)
+      break;
+    idequeuedel(b);
+    last->qnext = b;
+    last = b;
+  }
+  idecmd(first, n);
+}
+
+// Issue the command for the bufs chained from first through qnext,
+// n sectors in all.  Caller must hold idelock.
+static void
+idecmd(struct buf *first, int n)
+{
+  struct buf *b;
+  int i, d, write;
+  uint sector;
+
+  write = first->flags & B_DIRTY;
+  d = first->dev & 1;
+  sector = first->sector * BSECT;
+  if(sector < idepos[d])
+    nback++;
+  idepos[d] = sector + n;
+
+  idecur = idexbuf = first;
+  idexoff = 0;
+  idexleft = n;
+  ncmd++;
+  nsect += n;
+
+  if(idebm){
+    // One PRD per buf, joining bufs that are adjacent in the same
+    // page (so no PRD crosses a 64KB boundary).
+    i = -1;
+    for(b = first; b; b = b->qnext){
+      if(i >= 0 && prdt[i].addr + prdt[i].len == PADDR(b->data) &&
+         PGROUNDDOWN(prdt[i].addr) == PGROUNDDOWN(b->data)){
+        prdt[i].len += BSIZE;
+        continue;
+      }
+      i++;
+      prdt[i].addr = PADDR(b->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[i].flags = PRD_EOT;
+    outl(idebm + BM_PRDT, PADDR(prdt));
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);  // clear
+    outb(idebm + BM_CMD, write ? 0 : BM_CMD_READ);
+    ndma++;
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, n);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | (d<<4) | ((sector>>24)&0x0f));
+  if(idebm){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
+  } else if(write){
+    outb(0x1f7, idemult[d] > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    idepio(1);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idemult[d] > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
+  }
+}
+
+// Move the next block of sectors of the running command between
+// the disk and the bufs.  Caller must hold idelock.
+static void
+idepio(int write)
+{
+  int n;
+
+  n = idemult[idecur->dev & 1];
+  if(n > idexleft)
+    n = idexleft;
+  idexleft -= n;
+  for(; n > 0; n--){
+    if(write)
+      outsl(0x1f0, idexbuf->data + idexoff, SECTSIZE/4);
+    else
+      insl(0x1f0, idexbuf->data + idexoff, SECTSIZE/4);
+    idexoff += SECTSIZE;
+    if(idexoff == BSIZE){
+      idexbuf = idexbuf->qnext;
+      idexoff = 0;
+    }
   }
 }
 
@@ -90,41 +371,69 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  int st;
 
-  // Take first buffer off queue.
   acquire(&idelock);
-  if((b = idequeue) == 0){
+  if(idecur == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
+  nintr++;
+
+  if(idebm){
+    // The transfer is done: stop the controller and check for
+    // errors.  On error, fall back to PIO and redo the command.
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if(idewait(1) < 0 || (st & BM_ST_ERR)){
+      cprintf("ide: DMA error, using PIO\n");
+      idebm = 0;
+      idecmd(idecur, idexleft);
+      release(&idelock);
+      return;
+    }
+    idexleft = 0;
+  } else if(!(idecur->flags & B_DIRTY)){
+    // Move the next block of data; wait for more interrupts
+    // until the whole command is done.
+    if(idewait(1) >= 0)
+      idepio(0);
+    else
+      idexleft = 0;
+  } else if(idexleft > 0){
+    // The drive has taken the last block sent: send the next,
+    // and complete only on the interrupt that confirms the final
+    // one, with nothing left to send.
+    idepio(1);
+    release(&idelock);
+    return;
+  }
+  if(idexleft > 0){
+    release(&idelock);
+    return;
+  }
+
+  for(b = idecur; b; b = next){
+    next = b->qnext;
+    biodone(b);
+  }
+  idecur = 0;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
-  
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(idenq > 0)
+    idestart();
 
   release(&idelock);
 }
 
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Append b to idequeue and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b)
 {
-  struct buf **pp;
-
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -132,23 +441,76 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);
+  while(idenq == IDEQMAX)
+    sleep(&idenq, &idelock);
+  b->flags |= B_QUEUED;
+  idequeueadd(b);
+  nsubmit++;
+  ndepth += idenq + (idecur != 0);
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
-  
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-  
-  // Wait for request to finish.
+  if(idecur == 0)
+    idestart();
+}
+
+// Queue b for the disk like iderw(), but return at once; use
+// idewaitrw() or idedone() to learn when the request completes.
+// If B_ASYNC is set, biodone() instead releases b when the
+// request completes.
+void
+idesubmit(struct buf *b)
+{
+  acquire(&idelock);
+  ideappend(b);
+  release(&idelock);
+}
+
+// Has the request for b completed?
+int
+idedone(struct buf *b)
+{
+  int r;
+
+  acquire(&idelock);
+  r = !(b->flags & B_QUEUED);
+  release(&idelock);
+  return r;
+}
+
+// Wait for the request for b to complete.
+void
+idewaitrw(struct buf *b)
+{
+  acquire(&idelock);
   // Assuming will not sleep too long: ignore proc->killed.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while(b->flags & B_QUEUED){
     sleep(b, &idelock);
   }
+  release(&idelock);
+}
 
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idewaitrw(b);
+}
+
+// Fill in the disk counters of ks.
+void
+idestats(struct kstat *ks)
+{
+  acquire(&idelock);
+  ks->ideintrs = nintr;
+  ks->idecmds = ncmd;
+  ks->idesectors = nsect;
+  ks->idedmas = ndma;
+  ks->idelate = nlate;
+  ks->idebackseeks = nback;
+  ks->idesubmits = nsubmit;
+  ks->idedepthsum = ndepth;
   release(&idelock);
 }
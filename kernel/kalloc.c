@@ -1,12 +1,29 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Each CPU keeps a small cache of free pages in front of the
+// global free list, so most kalloc/kfree calls touch only
+// CPU-local state (with interrupts off) and never take kmem.lock.
+// An empty cache refills, and an overfull one drains, KBATCH
+// pages at a time under kmem.lock.  At most NCPU*KCACHESIZE
+// pages can sit in caches while the global list is empty.
+//
+// Every page also has a reference count, so that fork() can
+// share user pages copy-on-write.  kalloc() returns a page with
+// one reference; kfree() drops one and frees the page on the last.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "x86.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kstat.h"
+
+#define KCACHESIZE 16  // most pages a CPU cache holds
+#define KBATCH      8  // pages moved per refill or drain
 
 struct run {
   struct run *next;
@@ -15,42 +32,86 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  uint nlock;  // kmem.lock acquisitions
 } kmem;
 
+// Per-CPU page cache.  Only touched by its own CPU with
+// interrupts disabled, so it needs no lock.
+struct kcache {
+  struct run *freelist;
+  int n;
+  uint nalloc;  // kalloc calls
+  uint nhit;    // kalloc calls served without kmem.lock
+  uint nfree;   // kfree calls
+};
+
+static struct kcache kcache[NCPU];
+
+// Reference counts, indexed by physical page number.
+// Updated with atomic_add so they need no lock.
+static volatile int kref[PHYSTOP / PGSIZE];
+
 extern char end[]; // first address after kernel loaded from ELF file
 
 // Initialize free list of physical pages.
+// The pages go straight to the global list.
 void
 kinit(void)
 {
   char *p;
+  struct run *r;
 
   initlock(&kmem.lock, "kmem");
   p = (char*)PGROUNDUP((uint)end);
-  for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    r = (struct run*)p;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc().  The page is freed with its last reference.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  int i, n;
 
   if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
     panic("kfree");
 
+  if((n = atomic_add(&kref[(uint)v / PGSIZE], -1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  acquire(&kmem.lock);
+  pushcli();
+  c = &kcache[cpu->id];
+  c->nfree++;
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KCACHESIZE){
+    // Drain a batch back to the global list.
+    acquire(&kmem.lock);
+    kmem.nlock++;
+    for(i = 0; i < KBATCH; i++){
+      r = c->freelist;
+      c->freelist = r->next;
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
+    release(&kmem.lock);
+    c->n -= KBATCH;
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -60,12 +121,64 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  pushcli();
+  c = &kcache[cpu->id];
+  c->nalloc++;
+  if(c->n > 0)
+    c->nhit++;
+  else {
+    // Refill a batch from the global list.
+    acquire(&kmem.lock);
+    kmem.nlock++;
+    while(c->n < KBATCH && (r = kmem.freelist) != 0){
+      kmem.freelist = r->next;
+      r->next = c->freelist;
+      c->freelist = r;
+      c->n++;
+    }
+    release(&kmem.lock);
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->n--;
+    kref[(uint)r / PGSIZE] = 1;
+  }
+  popcli();
   return (char*)r;
 }
 
+// Add a reference to the kalloc'ed page v.
+void
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP)
+    panic("kdup");
+  if(atomic_add(&kref[(uint)v / PGSIZE], 1) < 2)
+    panic("kdup: free page");
+}
+
+// Return the number of references to the kalloc'ed page v.
+int
+krefcount(char *v)
+{
+  return kref[(uint)v / PGSIZE];
+}
+
+// Add the allocator counters to ks.
+void
+kallocstats(struct kstat *ks)
+{
+  struct kcache *c;
+
+  ks->kallocs = ks->kallochits = ks->kfrees = 0;
+  for(c = kcache; c < &kcache[NCPU]; c++){
+    ks->kallocs += c->nalloc;
+    ks->kallochits += c->nhit;
+    ks->kfrees += c->nfree;
+  }
+  ks->kmemlocks = kmem.nlock;
+}
+
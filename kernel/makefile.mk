@@ -6,6 +6,7 @@ KERNEL_OBJECTS := \
 	exec.o\
 	file.o\
 	fs.o\
+	futex.o\
 	ide.o\
 	ioapic.o\
 	kalloc.o\
@@ -13,6 +14,7 @@ KERNEL_OBJECTS := \
 	lapic.o\
 	main.o\
 	mp.o\
+	pci.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
@@ -135,9 +135,16 @@ struct segdesc {
 #define PTE_D		0x040	// Dirty
 #define PTE_PS		0x080	// Page Size
 #define PTE_MBZ		0x180	// Bits must be zero
+#define PTE_COW		0x200	// Copy-on-write (available to software)
+
+// Page fault error code bits.
+#define FEC_PR		0x1	// Fault on a present page (protection)
+#define FEC_WR		0x2	// Fault caused by a write
+#define FEC_U		0x4	// Fault occurred in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)	((uint)(pte) & ~0xFFF)
+#define PTE_FLAGS(pte)	((uint)(pte) & 0xFFF)
 
 typedef uint pte_t;
 
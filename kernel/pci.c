@@ -0,0 +1,58 @@
+// Minimal PCI configuration space access (mechanism #1),
+// enough to find a device by class and set it up.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR  0xCF8
+#define PCI_CONFDATA  0xCFC
+
+static uint
+pciaddr(struct pcidev *d, int off)
+{
+  return 0x80000000 | (d->bus << 16) | (d->dev << 11) |
+         (d->func << 8) | (off & 0xFC);
+}
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, pciaddr(d, off));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, pciaddr(d, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first function of the given class and subclass.
+// Return 0 and fill in *d if found, -1 otherwise.
+int
+pcifind(int class, int subclass, struct pcidev *d)
+{
+  uint c;
+
+  for(d->bus = 0; d->bus < 256; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      for(d->func = 0; d->func < 8; d->func++){
+        if((pciread(d, PCI_ID) & 0xFFFF) == 0xFFFF){
+          if(d->func == 0)
+            break;
+          continue;
+        }
+        c = pciread(d, PCI_CLASS);
+        if((c >> 24) == class && ((c >> 16) & 0xFF) == subclass)
+          return 0;
+        // Only multi-function devices have functions 1-7.
+        if(d->func == 0 && !(pciread(d, PCI_HEADER) & 0x800000))
+          break;
+      }
+    }
+  }
+  return -1;
+}
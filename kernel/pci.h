@@ -0,0 +1,23 @@
+#ifndef _PCI_H_
+#define _PCI_H_
+// PCI configuration space.
+
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+};
+
+#define PCI_ID        0x00  // device << 16 | vendor
+#define PCI_COMMAND   0x04  // command register in the low 16 bits
+#define PCI_CLASS     0x08  // class << 24 | subclass << 16 | prog if << 8
+#define PCI_HEADER    0x0C  // header type in bits 16-23
+#define PCI_BAR(n)    (0x10 + 4*(n))  // base address registers
+
+#define PCI_CMD_IO      0x1  // respond to I/O space accesses
+#define PCI_CMD_MASTER  0x4  // may act as bus master (DMA)
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+#endif // _PCI_H_
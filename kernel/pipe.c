@@ -6,18 +6,45 @@
 #include "fs.h"
 #include "file.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "kstat.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// The ring is a page of its own, and data moves through it in
+// contiguous chunks.  Readers and writers sleep only on an empty or
+// full pipe, so they are woken only when it stops being one (or,
+// for writers, when it drains; see below).
+#define PIPESIZE PGSIZE
+
+// Whole, page-aligned pages of a write are not copied but lent
+// (see uvmlend) and queued, and a page-aligned read of a whole
+// page maps the lent page in place of the reader's.  To keep the
+// bytes in order, the ring and the page queue are never both in
+// use: each kind of write waits for the other kind to drain.
+// Threaded processes always copy, since their page tables must
+// not hold copy-on-write pages.
+#define NPIPEPAGE 16
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  char *page[NPIPEPAGE];  // lent pages, in order
+  uint npread;    // number of pages read
+  uint npwrite;   // number of pages written
+  uint poff;      // bytes already read of page[npread % NPIPEPAGE]
 };
 
+static volatile int pipeflips;  // pages lent, updated with atomic_add
+
+#define PIPEEMPTY(p) ((p)->nread == (p)->nwrite && (p)->npread == (p)->npwrite)
+#define PIPEFULL(p) ((p)->nwrite == (p)->nread + PIPESIZE || \
+                     (p)->npwrite == (p)->npread + NPIPEPAGE)
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -29,6 +56,8 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((p->data = kalloc()) == 0)
+    goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -67,6 +96,9 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(; p->npread != p->npwrite; p->npread++)
+      kfree(p->page[p->npread % NPIPEPAGE]);
+    kfree(p->data);
     kfree((char*)p);
   } else
     release(&p->lock);
@@ -75,44 +107,199 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m, lend;
+  char *ka;
 
+  // Only a whole page can be lent; spare small writes the
+  // process table scan.
+  lend = n >= PGSIZE && !hasthreads(proc);
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    m = 0;
+    if(lend && (uint)(addr + i) % PGSIZE == 0 && n - i >= PGSIZE){
+      // Lend the page, once the ring has drained.
+      while(p->nwrite != p->nread ||
+            p->npwrite == p->npread + NPIPEPAGE){
+        if(p->readopen == 0 || proc->killed){
+          release(&p->lock);
+          return -1;
+        }
+        sleep(&p->nwrite, &p->lock);
+      }
+      if((ka = uvmlend(proc->pgdir, proc->sz, (uint)(addr + i))) != 0){
+        if(PIPEEMPTY(p))
+          wakeup(&p->nread);
+        p->page[p->npwrite++ % NPIPEPAGE] = ka;
+        atomic_add(&pipeflips, 1);
+        m = PGSIZE;
+        continue;
+      }
+    }
+
+    while(p->nwrite == p->nread + PIPESIZE ||
+          p->npwrite != p->npread){  //DOC: pipewrite-full
       if(p->readopen == 0 || proc->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    if(p->nread == p->nwrite)
+      wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    // Copy as much as fits before the ring is full or wraps,
+    // stopping at the next page that could be lent.
+    m = min(n - i, PIPESIZE - (p->nwrite - p->nread));
+    m = min(m, PIPESIZE - p->nwrite % PIPESIZE);
+    if(lend && n - i >= PGSIZE && (uint)(addr + i) % PGSIZE != 0)
+      m = min(m, PGSIZE - (uint)(addr + i) % PGSIZE);
+    memmove(p->data + p->nwrite % PIPESIZE, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// Copy up to n bytes out of p into addr, lent pages first.
+// If take, map whole lent pages into page-aligned parts of addr
+// instead of copying them.  Caller must hold p->lock.
+static int
+pipecopyout(struct pipe *p, char *addr, int n, int take)
+{
+  int i, m;
+  char *ka;
+
+  // Lent pages: map whole ones into page-aligned buffers,
+  // copy the rest.
+  for(i = 0; i < n && p->npread != p->npwrite; i += m){
+    ka = p->page[p->npread % NPIPEPAGE];
+    if(take && p->poff == 0 && (uint)(addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       uvmtake(proc->pgdir, proc->sz, (uint)(addr + i), ka) == 0){
+      p->npread++;
+      m = PGSIZE;
+      continue;
+    }
+    m = min(n - i, PGSIZE - p->poff);
+    memmove(addr + i, ka + p->poff, m);
+    p->poff += m;
+    if(p->poff == PGSIZE){
+      kfree(ka);
+      p->npread++;
+      p->poff = 0;
+    }
+  }
+
+  for(; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = min(n - i, p->nwrite - p->nread);
+    m = min(m, PIPESIZE - p->nread % PIPESIZE);
+    memmove(addr + i, p->data + p->nread % PIPESIZE, m);
+    p->nread += m;
+  }
+  return i;
+}
+
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, take, wasfull;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(PIPEEMPTY(p) && p->writeopen){  //DOC: pipe-empty
     if(proc->killed){
       release(&p->lock);
       return -1;
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  wasfull = PIPEFULL(p);
+  // Only a page-aligned buffer can take a lent page; spare other
+  // reads the process table scan.
+  take = n >= PGSIZE && (uint)addr % PGSIZE == 0 &&
+         p->npread != p->npwrite && !hasthreads(proc);
+  i = pipecopyout(p, addr, n, take);
+
+  // Wake writers waiting for room, or for the other kind of
+  // data to drain.
+  if(wasfull || PIPEEMPTY(p))
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  release(&p->lock);
+  return i;
+}
+
+// In-kernel transfers between pipes and files (see filesend).
+// Pipewait sleeps until p has room to write, if writing, or data
+// to read, and returns 1; it returns 0 at end of file and -1 if
+// the read end is closed or the process has been killed.  Pipeput
+// and pipeget then move up to n bytes between p and kernel memory
+// without sleeping, so they can be called with buffers and
+// inodes locked, and return the number of bytes moved.
+int
+pipewait(struct pipe *p, int writing)
+{
+  int r;
+
+  acquire(&p->lock);
+  for(;;){
+    if(proc->killed || (writing && p->readopen == 0)){
+      r = -1;
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    }
+    if(writing && p->nwrite != p->nread + PIPESIZE && p->npwrite == p->npread){
+      r = 1;
+      break;
+    }
+    if(!writing && !PIPEEMPTY(p)){
+      r = 1;
+      break;
+    }
+    if(!writing && p->writeopen == 0){
+      r = 0;
+      break;
+    }
+    sleep(writing ? (void*)&p->nwrite : (void*)&p->nread, &p->lock);
+  }
+  release(&p->lock);
+  return r;
+}
+
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int i, m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0 || p->npwrite != p->npread){
+    release(&p->lock);
+    return 0;
+  }
+  if(p->nread == p->nwrite && n > 0)
+    wakeup(&p->nread);
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; i += m){
+    m = min(n - i, PIPESIZE - (p->nwrite - p->nread));
+    m = min(m, PIPESIZE - p->nwrite % PIPESIZE);
+    memmove(p->data + p->nwrite % PIPESIZE, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+int
+pipeget(struct pipe *p, char *addr, int n)
+{
+  int i, wasfull;
+
+  acquire(&p->lock);
+  wasfull = PIPEFULL(p);
+  i = pipecopyout(p, addr, n, 0);
+  if(i > 0 && (wasfull || PIPEEMPTY(p)))
+    wakeup(&p->nwrite);
+  release(&p->lock);
+  return i;
+}
+
+// Fill in the pipe counters of ks.
+void
+pipestats(struct kstat *ks)
+{
+  ks->pipeflips = pipeflips;
+}
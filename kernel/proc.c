@@ -7,15 +7,64 @@
 #include "spinlock.h"
 #include "pstat.h"
 #include "proc_queue.h"
+#include "kstat.h"
 
 #define MAX_QUANTA 10
 
+// A CPU whose lowest queued pass is this far ahead of a peer's pulls
+// the peer's lowest-pass process over, so that pass values stay
+// comparable across CPUs and tickets are honoured machine-wide.
+#define STEAL_LAG STRIDE_DIV
+
+// Sleeping processes are hashed by wait channel so that wakeup()
+// only looks at processes that may be sleeping on that channel.
+// About one bucket per process slot keeps chains short.  The
+// hash takes the top bits of the product, which depend on all
+// bits of the channel address.
+#define NWAITQBITS 6
+#define NWAITQ (1 << NWAITQBITS)
+#define WAITQ(chan) \
+  (&ptable.waitq[(((uint)(chan) >> 2) * 2654435761U) >> (32 - NWAITQBITS)])
+
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
-  proc_queue pqueue;
+  struct proc *waitq[NWAITQ];  // Sleepers, chained through wqnext
 } ptable;
 
+// Per-CPU run queue.  Each CPU's scheduler holds its own rq->lock
+// across the swtch into a process (the job ptable.lock used to do),
+// so a process that is still switching out can never be popped and
+// started by another CPU.  Lock order: ptable.lock, then rq->lock.
+struct runqueue {
+  struct spinlock lock;
+  proc_queue queue;
+  int pass;  // Pass of the last process dispatched from this queue
+};
+
+static struct runqueue runqs[NCPU];
+
+// Timer wheel for sleep(n), protected by ptable.lock.
+// near[] holds deadlines less than TW0SIZE ticks away, one slot
+// per tick.  far[] holds deadlines up to TW0SIZE*TW1SIZE ticks away,
+// one slot per TW0SIZE ticks, and is cascaded into near[] as time
+// reaches each slot.  Anything further out waits on later.  Every
+// sleeper is made runnable exactly once, on the tick it expires.
+#define TW0BITS 8
+#define TW0SIZE (1 << TW0BITS)
+#define TW1SIZE 64
+
+static struct {
+  uint now;                    // Last tick processed
+  struct proc *near[TW0SIZE];
+  struct proc *far[TW1SIZE];
+  struct proc *later;
+  uint sleepers;               // Processes on the wheel
+  uint wakeups;                // Processes woken by expiry
+  uint ticks;                  // Ticks processed
+  uint cycles;                 // Cycles spent in wakeuptimers()
+} timers;
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -23,7 +72,7 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
-static void set_min_pass(struct proc* newproc);
+static void set_min_pass(struct runqueue* rq, struct proc* newproc);
 
 void
 getpstats1(struct pstat* stats)
@@ -36,6 +85,16 @@ getpstats1(struct pstat* stats)
     stats->pass[i]      = ptable.proc[i].schdldat.pass;
     stats->scheduled[i] = ptable.proc[i].schdldat.schdlnum;
     stats->ticks[i]     = ptable.proc[i].schdldat.schdlnum * 10; //Assuming 10ms quantum w/ no early interrupt
+    stats->cpu[i]       = ptable.proc[i].schdldat.cpu;
+    stats->migrated[i]  = ptable.proc[i].schdldat.migrated;
+    stats->size[i]      = ptable.proc[i].sz;
+    // Heap pages are only allocated when touched, so the size
+    // says little about memory use; count the mapped pages.
+    // exec() and wait() free page tables under ptable.lock.
+    if (ptable.proc[i].state != UNUSED && ptable.proc[i].state != EMBRYO)
+      stats->resident[i] = residentuvm(ptable.proc[i].pgdir, ptable.proc[i].sz);
+    else
+      stats->resident[i] = 0;
   }
 }
 
@@ -52,29 +111,119 @@ getpstats(struct pstat* stats)
   }
 }
 
-// Assumes ptable.lock has already been acquired
+// Assumes rq->lock has already been acquired
 static void
-set_min_pass(struct proc* newproc)
+set_min_pass(struct runqueue* rq, struct proc* newproc)
 {
-  struct proc* pmin = proc_queue_peek_min(&ptable.pqueue);
-  if (!newproc || !pmin)
+  struct proc* pmin = proc_queue_peek_min(&rq->queue);
+  if (!newproc)
     return;
 
+  // An empty queue still has a virtual time: the last dispatched pass
+  const int min_pass = pmin ? pmin->schdldat.pass : rq->pass;
+
   // Number of scheduler quanta for which the new process will occupy the CPU
-  const int pass_delta = pmin->schdldat.pass - newproc->schdldat.pass;
+  const int pass_delta = min_pass - newproc->schdldat.pass;
   const int quanta     = pass_delta / newproc->schdldat.stride;
 
   // Make the process take at most MAX_QUANTA scheduler quanta
   // before a different process is scheduled
   if (quanta > MAX_QUANTA)
-    newproc->schdldat.pass = pmin->schdldat.pass - (MAX_QUANTA * newproc->schdldat.stride);
+    newproc->schdldat.pass = min_pass - (MAX_QUANTA * newproc->schdldat.stride);
+}
+
+// Add p to the wait queue starting at head.
+// Caller must hold ptable.lock.
+static void
+waitq_insert(struct proc** head, struct proc* p)
+{
+  p->wqnext = *head;
+  p->wqprev = head;
+  if (*head)
+    (*head)->wqprev = &p->wqnext;
+  *head = p;
+}
+
+// Remove p from the wait queue it is sleeping on.
+// Caller must hold ptable.lock.
+static void
+waitq_remove(struct proc* p)
+{
+  *p->wqprev = p->wqnext;
+  if (p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  p->wqnext = 0;
+  p->wqprev = 0;
+}
+
+// Put p on the timer wheel slot for p->wakeat.
+// Caller must hold ptable.lock.
+static void
+timer_insert(struct proc* p)
+{
+  uint delta = p->wakeat - timers.now;
+
+  if (delta < TW0SIZE)
+    waitq_insert(&timers.near[p->wakeat % TW0SIZE], p);
+  else if (delta < TW0SIZE * TW1SIZE)
+    waitq_insert(&timers.far[(p->wakeat >> TW0BITS) % TW1SIZE], p);
+  else
+    waitq_insert(&timers.later, p);
+}
+
+// Re-file every process on the list at head.
+// Caller must hold ptable.lock.
+static void
+timer_cascade(struct proc** head)
+{
+  struct proc *p;
+
+  while ((p = *head) != 0) {
+    waitq_remove(p);
+    timer_insert(p);
+  }
+}
+
+// Lock and return the run queue of the current CPU.
+static struct runqueue*
+lockmyrq(void)
+{
+  struct runqueue *rq;
+
+  pushcli();
+  rq = &runqs[cpu->id];
+  acquire(&rq->lock);
+  popcli();
+  return rq;
+}
+
+// Mark p runnable and queue it on the CPU it last ran on.
+// If p is still switching out there, that CPU's scheduler
+// holds rq->lock, so we wait until p is off its stack.
+static void
+enqueue(struct proc* p, int wakeup)
+{
+  struct runqueue *rq = &runqs[p->schdldat.cpu];
+
+  acquire(&rq->lock);
+  p->state = RUNNABLE;
+  if (wakeup)
+    set_min_pass(rq, p);
+  proc_queue_insert(&rq->queue, p);
+  release(&rq->lock);
 }
 
 void
 pinit(void)
 {
+  struct runqueue *rq;
+
   initlock(&ptable.lock, "ptable");
-  proc_queue_init(&ptable.pqueue);
+  for (rq = runqs; rq < &runqs[NCPU]; rq++) {
+    initlock(&rq->lock, "runq");
+    proc_queue_init(&rq->queue);
+    rq->pass = 0;
+  }
 }
 
 // Look in the process table for an UNUSED proc.
@@ -100,6 +249,7 @@ found:
   p->schdldat.stride = STRIDE_DIV / DEFAULT_TICKETS;
   p->schdldat.pass = 0;
   p->schdldat.schdlnum = 0;
+  p->schdldat.migrated = 0;
 
   p->state = EMBRYO;
   p->pid = nextpid++;
@@ -129,9 +279,16 @@ found:
   return p;
 }
 
+// Caller must hold ptable.lock.
 void
 deallocproc(struct proc *p)
 {
+  // A zombie may still be switching out on its CPU; taking
+  // that run queue's lock waits for swtch to finish with
+  // the kernel stack we are about to free.
+  acquire(&runqs[p->schdldat.cpu].lock);
+  release(&runqs[p->schdldat.cpu].lock);
+
   kfree(p->kstack);
   p->stack = 0;
   p->kstack = 0;
@@ -170,11 +327,50 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  p->schdldat.cpu = cpu->id;
+  release(&ptable.lock);
 
-  p->state = RUNNABLE;
-  proc_queue_insert(&ptable.pqueue, p);
+  enqueue(p, 0);
+}
 
+// Start a kernel process that runs fn(), which must never return.
+// It has no user memory and never leaves the kernel.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  acquire(&ptable.lock);
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kproc: out of memory?");
+  p->sz = 0;
+  p->stack = 0;
+  // forkret returns into fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->schdldat.cpu = cpu->id;
   release(&ptable.lock);
+
+  enqueue(p, 0);
+}
+
+// Install pgdir and sz as the current process's user image,
+// as exec() does, and return the old page table for the caller
+// to free.  Done under ptable.lock so getpstats() never walks a
+// page table that is being freed.
+pde_t*
+setuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *old;
+
+  acquire(&ptable.lock);
+  old = proc->pgdir;
+  proc->pgdir = pgdir;
+  proc->sz = sz;
+  release(&ptable.lock);
+  return old;
 }
 
 // Grow current process's memory by n bytes.
@@ -187,27 +383,47 @@ growproc(int n)
   
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space: pages are allocated and
+    // zeroed when first touched (see uvmfault), so a large
+    // malloc arena costs nothing until it is used.
+    if(sz + n > USERTOP || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
-  proc->sz = sz;
-
-  // Update the sizes of child threads.
+  // Every thread sharing the page table sees the new size: its
+  // page faults are checked against it (see uvmfault).
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
-	  if (p->parent == proc && p->pgdir == proc->pgdir) {
-		  p->sz = sz;
-	  }
-  }
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pgdir == proc->pgdir)
+      p->sz = sz;
   release(&ptable.lock);
 
   switchuvm(proc);
   return 0;
 }
 
+// Return whether another process (a thread) shares p's page table.
+int
+hasthreads(struct proc *p)
+{
+  struct proc *q;
+  int found;
+
+  found = 0;
+  acquire(&ptable.lock);
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++){
+    if(q != p && q->state != UNUSED && q->pgdir == p->pgdir){
+      found = 1;
+      break;
+    }
+  }
+  release(&ptable.lock);
+  return found;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -221,8 +437,10 @@ fork(void)
   if((np = allocproc()) == 0)
     return -1;
 
-  // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  // Copy process state from p.  Memory is shared copy-on-write,
+  // except for a threaded parent: its other threads could keep
+  // writing through stale TLB entries (see cowbreakuvm).
+  if((np->pgdir = copyuvm(proc->pgdir, proc->sz, !hasthreads(proc))) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -236,7 +454,7 @@ fork(void)
   np->schdldat.tickets = proc->schdldat.tickets;
   np->schdldat.stride = proc->schdldat.stride;
   np->schdldat.pass = proc->schdldat.pass;
-
+  np->schdldat.cpu = proc->schdldat.cpu;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -247,13 +465,10 @@ fork(void)
   np->cwd = idup(proc->cwd);
  
   pid = np->pid;
-  np->state = RUNNABLE;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
 
-  // Insert the process into the queue
-  acquire(&ptable.lock);
-  proc_queue_insert(&ptable.pqueue, np);
-  release(&ptable.lock);
+  // Insert the process into its parent's run queue
+  enqueue(np, 0);
 
   return pid;
 }
@@ -272,6 +487,11 @@ clone(void(*fcn)(void*), void *arg, void *stack)
     return -1;
   }
 
+  // A page table shared by threads must not hold copy-on-write pages.
+  if (cowbreakuvm(proc->pgdir, proc->sz) < 0) {
+    return -1;
+  }
+
   // Allocate a new process
   if ((np = allocproc()) == 0) {
     return -1;
@@ -287,6 +507,7 @@ clone(void(*fcn)(void*), void *arg, void *stack)
   np->schdldat.tickets = proc->schdldat.tickets;
   np->schdldat.stride = proc->schdldat.stride;
   np->schdldat.pass = proc->schdldat.pass;
+  np->schdldat.cpu = proc->schdldat.cpu;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -313,13 +534,10 @@ clone(void(*fcn)(void*), void *arg, void *stack)
   np->cwd = idup(proc->cwd);
 
   pid = np->pid;
-  np->state = RUNNABLE;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
 
-  // Insert the process into the queue
-  acquire(&ptable.lock);
-  proc_queue_insert(&ptable.pqueue, np);
-  release(&ptable.lock);
+  // Insert the process into its parent's run queue
+  enqueue(np, 0);
 
   return pid;
 }
@@ -405,7 +623,11 @@ exit(void)
   }
 
   // Jump into the scheduler, never to return.
+  // Holding the run queue lock keeps wait() from freeing
+  // our kernel stack until sched() has switched off it.
   proc->state = ZOMBIE;
+  lockmyrq();
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -449,6 +671,55 @@ wait(void)
   }
 }
 
+// Called by a CPU's scheduler with no locks held.
+// If this CPU has nothing queued, take work from the busiest peer.
+// Otherwise pull a peer's lowest-pass process only if it lags ours
+// by more than STEAL_LAG, which keeps pass values comparable across
+// CPUs.  Peer queues are peeked without their locks; the choice is
+// only a hint and is rechecked under the victim's lock.
+// Returns the stolen process, or 0.
+static struct proc*
+steal(struct runqueue* myrq)
+{
+  struct runqueue *rq, *victim;
+  struct proc *p, *mymin;
+  int best;
+
+  mymin = proc_queue_peek_min(&myrq->queue);
+  victim = 0;
+  best = 0;
+  for (rq = runqs; rq < &runqs[ncpu]; rq++) {
+    if (rq == myrq || (p = proc_queue_peek_min(&rq->queue)) == 0)
+      continue;
+    if (!mymin) {
+      if (proc_queue_size(&rq->queue) > best) {
+        best = proc_queue_size(&rq->queue);
+        victim = rq;
+      }
+    }
+    else if (p->schdldat.pass + STEAL_LAG < mymin->schdldat.pass) {
+      if (!victim || p->schdldat.pass < best) {
+        best = p->schdldat.pass;
+        victim = rq;
+      }
+    }
+  }
+  if (!victim)
+    return 0;
+
+  acquire(&victim->lock);
+  p = proc_queue_pop_min(&victim->queue);
+  release(&victim->lock);
+
+  if (p) {
+    // An idle queue adopts its victim's virtual time
+    if (!mymin)
+      myrq->pass = victim->pass;
+    p->schdldat.migrated++;
+  }
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -460,19 +731,26 @@ void
 scheduler(void)
 {
   struct proc *p;
+  struct runqueue *rq;
 
+  rq = &runqs[cpu->id];
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    acquire(&ptable.lock);
+    p = steal(rq);
+
+    acquire(&rq->lock);
 
     // Run the process with the minimum pass value
-    p = proc_queue_pop_min(&ptable.pqueue);
+    if (!p)
+      p = proc_queue_pop_min(&rq->queue);
 
     if (p && p->state == RUNNABLE) {
+      rq->pass = p->schdldat.pass;
       p->schdldat.pass += p->schdldat.stride;
       p->schdldat.schdlnum++;
+      p->schdldat.cpu = cpu->id;
       proc = p;
       switchuvm(p);
       p->state = RUNNING;
@@ -487,20 +765,20 @@ scheduler(void)
         cprintf("non-runnable process in queue: %s (0x%p) (state: %d)\n", p->name, p, p->state);
     }
     
-    release(&ptable.lock);
+    release(&rq->lock);
 
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state.
+// Enter scheduler.  Must hold only the current CPU's run
+// queue lock and have changed proc->state.
 void
 sched(void)
 {
   int intena;
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&runqs[cpu->id].lock))
+    panic("sched runq lock");
   if(cpu->ncli != 1)
     panic("sched locks");
   if(proc->state == RUNNING)
@@ -516,11 +794,15 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
+  struct runqueue *rq;
+
+  rq = lockmyrq();  //DOC: yieldlock
   proc->state = RUNNABLE;
-  proc_queue_insert(&ptable.pqueue, proc);
+  proc_queue_insert(&rq->queue, proc);
   sched();
-  release(&ptable.lock);
+
+  // We may have been stolen by another CPU; release its lock.
+  release(&runqs[cpu->id].lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -528,12 +810,32 @@ yield(void)
 void
 forkret(void)
 {
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding this CPU's run queue lock from scheduler.
+  release(&runqs[cpu->id].lock);
   
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// Sleep on chan.  The caller has already put proc on the
+// wait queue that will wake it.
+// Called with ptable.lock held; returns with no locks held.
+static void
+sleepon(void *chan)
+{
+  // Go to sleep.
+  // Wakeup queues us on this CPU's run queue, whose lock
+  // we hold until sched() has switched off our stack.
+  proc->chan = chan;
+  proc->state = SLEEPING;
+  lockmyrq();
+  release(&ptable.lock);
+  sched();
+  release(&runqs[cpu->id].lock);
+
+  // Tidy up.
+  proc->chan = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -556,19 +858,80 @@ sleep(void *chan, struct spinlock *lk)
     release(lk);
   }
 
-  // Go to sleep.
-  proc->chan = chan;
-  proc->state = SLEEPING;
-  sched();
-
-  // Tidy up.
-  proc->chan = 0;
+  waitq_insert(WAITQ(chan), proc);
+  sleepon(chan);
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
+  acquire(lk);
+}
+
+// Sleep for n clock ticks on the timer wheel.
+// Returns 0 once they have passed, -1 if killed first.
+int
+sleepticks(uint n)
+{
+  uint deadline;
+
+  acquire(&ptable.lock);
+  deadline = timers.now + n;
+  while((int)(deadline - timers.now) > 0){
+    if(proc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    proc->wakeat = deadline;
+    timer_insert(proc);
+    timers.sleepers++;
+    sleepon(&ticks);
+    acquire(&ptable.lock);
+    timers.sleepers--;
   }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Called on every clock tick with the new tick count.
+// Wakes the processes whose sleep() deadline has arrived.
+void
+wakeuptimers(uint now)
+{
+  struct proc *p, *next, **slot;
+  uint t0;
+
+  t0 = rdtsc();
+  acquire(&ptable.lock);
+  while(timers.now != now){
+    timers.now++;
+    timers.ticks++;
+    if(timers.now % TW0SIZE == 0){
+      if((timers.now >> TW0BITS) % TW1SIZE == 0)
+        timer_cascade(&timers.later);
+      timer_cascade(&timers.far[(timers.now >> TW0BITS) % TW1SIZE]);
+    }
+    slot = &timers.near[timers.now % TW0SIZE];
+    for(p = *slot; p; p = next){
+      next = p->wqnext;
+      if(p->wakeat == timers.now){
+        waitq_remove(p);
+        timers.wakeups++;
+        enqueue(p, 1);
+      }
+    }
+  }
+  timers.cycles += rdtsc() - t0;
+  release(&ptable.lock);
+}
+
+// Copy the timer wheel counters into ks.
+void
+timerstats(struct kstat *ks)
+{
+  acquire(&ptable.lock);
+  ks->ticks = timers.ticks;
+  ks->tickcycles = timers.cycles;
+  ks->timersleepers = timers.sleepers;
+  ks->timerwakeups = timers.wakeups;
+  release(&ptable.lock);
 }
 
 // Wake up all processes sleeping on chan.
@@ -576,14 +939,15 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
-      set_min_pass(p);
-      proc_queue_insert(&ptable.pqueue, p);
+  for(p = *WAITQ(chan); p; p = next){
+    next = p->wqnext;
+    if(p->chan == chan){
+      waitq_remove(p);
+      enqueue(p, 1);
     }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -595,9 +959,44 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up at most n processes sleeping on chan, those that have
+// slept longest first, so none starves.  Sleepers are pushed on
+// the front of their wait queue: skip all but the last n.
+// Returns the number woken.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p, *next;
+  int skip, woken;
+
+  acquire(&ptable.lock);
+  skip = 0;
+  for(p = *WAITQ(chan); p; p = p->wqnext)
+    if(p->chan == chan)
+      skip++;
+  skip = skip > n ? skip - n : 0;
+  woken = 0;
+  for(p = *WAITQ(chan); p; p = next){
+    next = p->wqnext;
+    if(p->chan != chan)
+      continue;
+    if(skip > 0){
+      skip--;
+      continue;
+    }
+    waitq_remove(p);
+    enqueue(p, 1);
+    woken++;
+  }
+  release(&ptable.lock);
+  return woken;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
-// to user space (see trap in trap.c).
+// to user space (see trap in trap.c).  Kernel processes (see
+// kproc), which have no user memory and never return to user
+// space, cannot be killed.
 int
 kill(int pid)
 {
@@ -606,11 +1005,15 @@ kill(int pid)
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
+      if(p->sz == 0){
+        release(&ptable.lock);
+        return -1;
+      }
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING) {
-        p->state = RUNNABLE;
-        proc_queue_insert(&ptable.pqueue, p);
+        waitq_remove(p);
+        enqueue(p, 0);
       }
       release(&ptable.lock);
       return 0;
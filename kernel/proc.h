@@ -68,6 +68,8 @@ struct scheduling {
   int stride;    // Process stride (calculated using tickets)
   int pass;      // Current pass value of the process
   int schdlnum;  // Number of times the process has been scheduled
+  int cpu;       // CPU whose run queue the process belongs to
+  int migrated;  // Number of times the process was stolen by another CPU
 };
 
 // Per-process state
@@ -83,6 +85,9 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Next sleeper in chan's wait queue
+  struct proc **wqprev;        // Link pointing at us in the wait queue
+  uint wakeat;                 // Tick at which sleep() ends
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -57,6 +57,12 @@ proc_queue_pop_min(proc_queue* queue)
   return node.data; 
 }
 
+int
+proc_queue_size(const proc_queue* queue)
+{
+  return queue->heap.size;
+}
+
 void
 proc_queue_print(const proc_queue* queue)
 {
@@ -37,6 +37,7 @@ void proc_queue_rebuild(proc_queue* queue);
 void proc_queue_insert(proc_queue* queue, struct proc* p);
 struct proc* proc_queue_peek_min(const proc_queue* queue);
 struct proc* proc_queue_pop_min(proc_queue* queue);
+int proc_queue_size(const proc_queue* queue);
 void proc_queue_print(const proc_queue* queue);
 
 #endif //_PROC_QUEUE_H_
\ No newline at end of file
@@ -19,6 +19,8 @@ fetchint(struct proc *p, uint addr, int *ip)
 {
   if(addr >= p->sz || addr+4 > p->sz || addr < PGSIZE)
     return -1;
+  if(uvmprefault(p->pgdir, p->sz, addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -35,9 +37,13 @@ fetchstr(struct proc *p, uint addr, char **pp)
     return -1;
   *pp = (char*)addr;
   ep = (char*)p->sz;
-  for(s = *pp; s < ep; s++)
+  for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmprefault(p->pgdir, p->sz, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
+  }
   return -1;
 }
 
@@ -50,9 +56,10 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size n bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+// lies within the process address space, and fault the block in
+// (for writing, if write).
+static int
+argblock(int n, char **pp, int size, int write)
 {
   int i;
   
@@ -60,10 +67,25 @@ argptr(int n, char **pp, int size)
     return -1;
   if((uint)i >= proc->sz || (uint)i+size > proc->sz || (uint)i < PGSIZE)
     return -1;
+  if(uvmprefault(proc->pgdir, proc->sz, i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+int
+argptr(int n, char **pp, int size)
+{
+  return argblock(n, pp, size, 0);
+}
+
+// Like argptr, for a block the system call will write to.
+int
+argoutptr(int n, char **pp, int size)
+{
+  return argblock(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -108,6 +130,16 @@ static int (*syscalls[])(void) = {
 [SYS_getpinfo]  sys_getpinfo,
 [SYS_clone]     sys_clone,
 [SYS_join]      sys_join,
+[SYS_getkstat]  sys_getkstat,
+[SYS_sync]      sys_sync,
+[SYS_fsync]     sys_fsync,
+[SYS_biobench]  sys_biobench,
+[SYS_sendfile]  sys_sendfile,
+[SYS_pread]     sys_pread,
+[SYS_pwrite]    sys_pwrite,
+[SYS_readv]     sys_readv,
+[SYS_writev]    sys_writev,
+[SYS_futex]     sys_futex,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 #include "sysfunc.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -65,7 +66,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argoutptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -82,6 +83,105 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Move up to n bytes from file in_fd to out_fd inside the kernel,
+// where one is a file and the other a pipe.  Off is the offset in
+// the file, or -1 for the file's own offset.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0)
+    return -1;
+  return filesend(out, in, off, n);
+}
+
+// Fetch the iovec array that is the nth system call argument,
+// with the count in the next argument, into iov.  Check that
+// every buffer lies within the process address space, and fault
+// it in (for writing, if write) as argptr does.
+static int
+argiov(int n, struct iovec *iov, int write)
+{
+  struct iovec *uiov;
+  int cnt, i;
+  uint base;
+
+  if(argint(n+1, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(argptr(n, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    base = (uint)iov[i].iov_base;
+    if(base < PGSIZE || base >= proc->sz || iov[i].iov_len > proc->sz - base)
+      return -1;
+    if(uvmprefault(proc->pgdir, proc->sz, base, iov[i].iov_len, write) < 0)
+      return -1;
+  }
+  return cnt;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov, 1)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov, 0)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// Read or write at the given offset, without using or changing
+// the file's own offset.
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argoutptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.iov_base = p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.iov_base = p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
 int
 sys_close(void)
 {
@@ -101,11 +201,49 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
   
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argoutptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
 
+// Disk queue benchmark: read the first n blocks of the root
+// disk with up to depth requests in flight (see bbench).
+int
+sys_biobench(void)
+{
+  struct superblock sb;
+  int n, depth;
+
+  if(argint(0, &n) < 0 || argint(1, &depth) < 0)
+    return -1;
+  readsb(ROOTDEV, &sb);
+  if(n > sb.size)
+    n = sb.size;
+  return bbench(ROOTDEV, n, depth);
+}
+
+// Write all dirty buffers to disk.
+int
+sys_sync(void)
+{
+  bflush();
+  return 0;
+}
+
+// Make fd's data durable.  The buffer cache does not track which
+// buffers belong to which inode, so this flushes them all.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE)
+    bflush();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -165,7 +303,6 @@ int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
 
@@ -195,9 +332,7 @@ sys_unlink(void)
     return -1;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -288,6 +423,7 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = f->ranext = f->rawin = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -374,7 +510,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argoutptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -28,4 +28,14 @@ int sys_getticket(void);
 int sys_getpinfo(void);
 int sys_clone(void);
 int sys_join(void);
+int sys_getkstat(void);
+int sys_sync(void);
+int sys_fsync(void);
+int sys_biobench(void);
+int sys_sendfile(void);
+int sys_pread(void);
+int sys_pwrite(void);
+int sys_readv(void);
+int sys_writev(void);
+int sys_futex(void);
 #endif // _SYSFUNC_H_
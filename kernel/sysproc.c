@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "sysfunc.h"
 #include "pstat.h"
+#include "kstat.h"
 
 int
 sys_fork(void)
@@ -39,7 +40,7 @@ sys_clone(void)
 int
 sys_join(void){
   void **stack;
-  if (argptr(0, (void *)&stack, sizeof(stack)) < 0) {
+  if (argoutptr(0, (void *)&stack, sizeof(stack)) < 0) {
     return -1;
   }
   return join(stack);
@@ -92,21 +93,12 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
   
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(proc->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  return sleepticks(n);
 }
 
 // return how many clock tick interrupts have occurred
@@ -153,9 +145,38 @@ int
 sys_getpinfo(void)
 {
   struct pstat* stats;
-  if (argptr(0, (void*)&stats, sizeof(*stats)) < 0)
+  if (argoutptr(0, (void*)&stats, sizeof(*stats)) < 0)
     return -1;
   
   getpstats(stats);
   return 0;
-}
\ No newline at end of file
+}
+
+int
+sys_getkstat(void)
+{
+  struct kstat* stats;
+  if (argoutptr(0, (void*)&stats, sizeof(*stats)) < 0)
+    return -1;
+
+  timerstats(stats);
+  kallocstats(stats);
+  bcachestats(stats);
+  fsstats(stats);
+  dcachestats(stats);
+  pipestats(stats);
+  futexstats(stats);
+  idestats(stats);
+  return 0;
+}
+
+// futex(addr, op, val): see futex.c.
+int
+sys_futex(void)
+{
+  int addr, op, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex(addr, op, val);
+}
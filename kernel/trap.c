@@ -49,8 +49,8 @@ trap(struct trapframe *tf)
     if(cpu->id == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
       release(&tickslock);
+      wakeuptimers(ticks);
     }
     lapiceoi();
     break;
@@ -75,7 +75,16 @@ trap(struct trapframe *tf)
             cpu->id, tf->cs, tf->eip);
     lapiceoi();
     break;
-   
+
+  case T_PGFLT:
+    // First touch of a heap page reserved by sbrk(), or first
+    // write to a page shared copy-on-write by fork().  System
+    // calls fault their user buffers in when checking them (see
+    // argptr), so that running out of memory fails the call;
+    // a failed fault from the kernel here is a bug.
+    if(proc && uvmfault(proc->pgdir, proc->sz, rcr2(), tf->err & FEC_WR) == 0)
+      break;
+    // fall through
   default:
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
@@ -5,10 +5,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
 
 extern char data[];  // defined in data.S
 
 static pde_t *kpgdir;  // for use in scheduler()
+static struct spinlock uvmlock;  // serializes uvmfault()
 
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
@@ -16,6 +18,7 @@ void
 kvmalloc(void)
 {
   kpgdir = setupkvm();
+  initlock(&uvmlock, "uvm");
 }
 
 // Set up CPU's kernel segment descriptors.
@@ -157,6 +160,7 @@ vmenable(void)
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
   cr0 |= CR0_PG;
+  cr0 |= CR0_WP;  // kernel writes to read-only (copy-on-write) pages fault too
   lcr0(cr0);
 }
 
@@ -294,10 +298,22 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Flush the TLB if pgdir is the page table in use.
+static void
+flushuvm(pde_t *pgdir)
+{
+  if(rcr3() == PADDR(pgdir))
+    lcr3(PADDR(pgdir));
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  If cow is set, the child shares the
+// parent's pages: writable pages become read-only and
+// PTE_COW in both page tables, and are copied on the first
+// write (see uvmfault).  Otherwise every page is copied now.
+// Pages that sbrk() reserved but nobody touched stay unmapped.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, int cow)
 {
   pde_t *d;
   pte_t *pte;
@@ -307,24 +323,203 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = PGSIZE; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
     pa = PTE_ADDR(*pte);
+    if(cow){
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_P) < 0)
+        goto bad;
+      kdup((char*)pa);
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)pa, PGSIZE);
     if(mappages(d, (void*)i, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
       goto bad;
   }
+  if(cow)
+    flushuvm(pgdir);
   return d;
 
 bad:
+  if(cow)
+    flushuvm(pgdir);
   freevm(d);
   return 0;
 }
 
+// Handle a fault on user address va in pgdir, whose process has
+// size sz.  Two kinds of page are filled in on demand:
+//  - pages reserved by sbrk() but never touched (see growproc),
+//    which are allocated and zeroed now;
+//  - on a write, copy-on-write pages shared by fork(), which get
+//    their own writable copy (or are simply taken over if no one
+//    else shares them any more).
+// Returns 0 if the access may be retried, -1 if it is a real
+// fault or memory is exhausted.
+int
+uvmfault(pde_t *pgdir, uint sz, uint va, int write)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+  int r;
+
+  if(va < PGSIZE || va >= sz || va >= USERTOP)
+    return -1;
+
+  acquire(&uvmlock);
+  r = -1;
+  pte = walkpgdir(pgdir, (void*)va, 1);
+  if(pte == 0)
+    goto out;
+  if(!(*pte & PTE_P)){
+    if((mem = kalloc()) == 0)
+      goto out;
+    memset(mem, 0, PGSIZE);
+    *pte = PADDR(mem) | PTE_P | PTE_W | PTE_U;
+  } else if(write && !(*pte & PTE_W)){
+    if(!(*pte & PTE_COW))
+      goto out;
+    pa = PTE_ADDR(*pte);
+    if(krefcount((char*)pa) == 1){
+      *pte = (*pte & ~PTE_COW) | PTE_W;
+    } else {
+      if((mem = kalloc()) == 0)
+        goto out;
+      memmove(mem, (char*)pa, PGSIZE);
+      *pte = PADDR(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+      kfree((char*)pa);
+    }
+  }
+  // Otherwise another thread sharing pgdir got here first,
+  // or the TLB was stale.
+  flushuvm(pgdir);
+  r = 0;
+
+out:
+  release(&uvmlock);
+  return r;
+}
+
+// Fault in the user pages covering [va, va+n), for writing if
+// write, before the kernel touches them.  A system call whose
+// arguments are checked this way fails with -1 when memory runs
+// out, rather than faulting in the kernel.
+int
+uvmprefault(pde_t *pgdir, uint sz, uint va, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = (uint)PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (!write || (*pte & PTE_W)))
+      continue;
+    if(uvmfault(pgdir, sz, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Return the number of resident (allocated) user pages below sz.
+int
+residentuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = 0; a < sz && a < USERTOP; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if(!(*pde & PTE_P))
+      continue;
+    pgtab = (pte_t*)PTE_ADDR(*pde);
+    if(pgtab[PTX(a)] & PTE_P)
+      n++;
+  }
+  return n;
+}
+
+// Give pgdir private, writable copies of all its copy-on-write
+// pages below sz.  Used before a page table is shared between
+// threads: a thread on another CPU could keep using a stale TLB
+// entry for a page that uvmfault() has replaced, and there is no
+// TLB shootdown, so shared page tables never hold PTE_COW pages.
+// Returns 0 on success, -1 if out of memory.
+int
+cowbreakuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint i;
+
+  for(i = PGSIZE; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
+      continue;
+    if((*pte & PTE_COW) && uvmfault(pgdir, sz, i, 1) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Lend the page at page-aligned user address va to a zero-copy
+// pipe: make it copy-on-write in pgdir, so that later writes by
+// its owner go to a copy, and return its kernel address with a
+// new reference for the borrower.  Returns 0 if there is no page
+// there yet.  pgdir must not be shared by threads (see cowbreakuvm).
+char*
+uvmlend(pde_t *pgdir, uint sz, uint va)
+{
+  pte_t *pte;
+  char *ka;
+
+  if(va < PGSIZE || va + PGSIZE > sz || va + PGSIZE > USERTOP)
+    return 0;
+  acquire(&uvmlock);
+  ka = 0;
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte && (*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U)){
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    ka = (char*)PTE_ADDR(*pte);
+    kdup(ka);
+    flushuvm(pgdir);
+  }
+  release(&uvmlock);
+  return ka;
+}
+
+// Map a page lent by uvmlend at page-aligned user address va in
+// pgdir, copy-on-write, in place of the page there; takes over
+// the caller's reference to ka.  Returns -1 if va is not below sz.
+// pgdir must not be shared by threads.
+int
+uvmtake(pde_t *pgdir, uint sz, uint va, char *ka)
+{
+  pte_t *pte;
+  uint old;
+
+  if(va < PGSIZE || va + PGSIZE > sz || va + PGSIZE > USERTOP)
+    return -1;
+  acquire(&uvmlock);
+  if((pte = walkpgdir(pgdir, (void*)va, 1)) == 0){
+    release(&uvmlock);
+    return -1;
+  }
+  old = *pte;
+  *pte = PADDR(ka) | PTE_P | PTE_U | PTE_COW;
+  flushuvm(pgdir);
+  release(&uvmlock);
+  if(old & PTE_P)
+    kfree((char*)PTE_ADDR(old));
+  return 0;
+}
+
 // Map user virtual address to kernel physical address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
@@ -332,7 +527,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -347,10 +542,20 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
   
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writes through the kernel mapping bypass the user PTE, so
+    // demand-zero and copy-on-write pages of the current process
+    // must be faulted in first.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_W)) != (PTE_P|PTE_W)){
+      if(proc == 0 || pgdir != proc->pgdir ||
+         uvmfault(pgdir, proc->sz, va0, 1) < 0)
+        return -1;
+    }
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -17,15 +17,16 @@
 #undef stat
 #undef dirent
 
-#define BLOCK_SIZE (512)
+#define BLOCK_SIZE (BSIZE)
 
-int nblocks = 995;
+int nblocks;
 int ninodes = 200;
-int size = 1024;
+int size = 4096;
+int extents;  // -e: build an FS_EXTENTS file system
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -39,6 +40,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint bmap(struct dinode *din, uint fbn);
+uint xbmap(struct dinode *din, uint fbn);
 
 // convert to intel byte order
 ushort
@@ -65,18 +68,21 @@ xint(uint x)
 
 
 int 
-mkfs(int nblocks, int ninodes, int size) {
+mkfs(int ninodes, int size) {
 
   int i;
   char buf[BLOCK_SIZE];
 
+  bitblocks = size/BPB + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks;
+
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
-
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
+  sb.flags = xint(extents ? FS_EXTENTS : 0);
+  sb.bsize = xint(BSIZE);
 
   printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
          bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
@@ -203,13 +209,18 @@ main(int argc, char *argv[])
   int r;
   DIR *root_dir;
 
+  if(argc > 1 && strcmp(argv[1], "-e") == 0){
+    extents = 1;
+    argc--;
+    argv++;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct xv6_dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct xv6_dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -217,7 +228,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  mkfs(995, 200, 1024);
+  mkfs(ninodes, size);
 
   root_dir = opendir(argv[2]);
 
@@ -237,11 +248,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -256,7 +267,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -270,7 +281,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -283,11 +294,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -310,12 +321,12 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BPB);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
@@ -331,40 +342,19 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
+  char buf[BSIZE];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
+    fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    x = extents ? xbmap(&din, fbn) : bmap(&din, fbn);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -373,3 +363,127 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Allocate a data block.  Blocks were zeroed by mkfs.
+uint
+newblock(void)
+{
+  assert(freeblock < size);
+  usedblocks++;
+  return freeblock++;
+}
+
+// Return the block holding block fbn of the file din,
+// allocating it and any index blocks on the way to it.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, level, span, i;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(newblock());
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  span = NINDIRECT;
+  for(level = 1; fbn >= span; level++){
+    assert(level < 3);
+    fbn -= span;
+    span *= NINDIRECT;
+  }
+
+  if(xint(din->addrs[NDIRECT+level-1]) == 0)
+    din->addrs[NDIRECT+level-1] = xint(newblock());
+  addr = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    span /= NINDIRECT;
+    rsect(addr, (char*)indirect);
+    i = fbn / span;
+    if(indirect[i] == 0){
+      indirect[i] = xint(newblock());
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[i]);
+    fbn %= span;
+  }
+  return addr;
+}
+
+// Read (or, if write is set, write) extent k of the
+// extent-format file din.  Reading an extent that has no
+// slot yet gives a zero extent.
+void
+xrw(struct dinode *din, uint k, struct extent *e, int write)
+{
+  struct extent x[NXEXTENT];
+  uint index[NINDIRECT], sec;
+
+  if(k < NIEXTENT){
+    if(write)
+      ((struct extent*)din->addrs)[k] = *e;
+    else
+      *e = ((struct extent*)din->addrs)[k];
+    return;
+  }
+  k -= NIEXTENT;
+  assert(k / NXEXTENT < NINDIRECT);
+  if(!write)
+    bzero(e, sizeof(*e));
+
+  if(xint(din->addrs[XINDEX]) == 0){
+    if(!write)
+      return;
+    din->addrs[XINDEX] = xint(newblock());
+  }
+  rsect(xint(din->addrs[XINDEX]), (char*)index);
+  if(xint(index[k / NXEXTENT]) == 0){
+    if(!write)
+      return;
+    index[k / NXEXTENT] = xint(newblock());
+    wsect(xint(din->addrs[XINDEX]), (char*)index);
+  }
+  sec = xint(index[k / NXEXTENT]);
+  rsect(sec, (char*)x);
+  if(write){
+    x[k % NXEXTENT] = *e;
+    wsect(sec, (char*)x);
+  } else
+    *e = x[k % NXEXTENT];
+}
+
+// Extent-format version of bmap.  Files are written in order,
+// so fbn is mapped already or is the next block.
+uint
+xbmap(struct dinode *din, uint fbn)
+{
+  struct extent e;
+  uint k, lblk, b;
+
+  lblk = 0;
+  for(k = 0; ; k++){
+    xrw(din, k, &e, 0);
+    if(xint(e.len) == 0)
+      break;
+    if(fbn < lblk + xint(e.len))
+      return xint(e.start) + fbn - lblk;
+    lblk += xint(e.len);
+  }
+  assert(fbn == lblk);
+
+  b = newblock();
+  if(k > 0){
+    xrw(din, k-1, &e, 0);
+    if(xint(e.start) + xint(e.len) == b){
+      e.len = xint(xint(e.len) + 1);
+      xrw(din, k-1, &e, 1);
+      return b;
+    }
+  }
+  e.start = xint(b);
+  e.len = xint(1);
+  xrw(din, k, &e, 1);
+  return b;
+}
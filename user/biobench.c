@@ -0,0 +1,45 @@
+// Disk queue benchmark.  Has the kernel read the start of the
+// root disk with 1, 2, 4, ... requests in flight and reports the
+// time per block, the number of disk commands (after merging) and
+// the average queue depth the requests saw.
+
+#include "types.h"
+#include "stat.h"
+#include "kstat.h"
+#include "user.h"
+#include "x86.h"
+
+#define NBLOCKS 512
+#define MAXDEPTH 64
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  uint start, cycles, subs;
+  int n, depth, t;
+
+  n = NBLOCKS;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  printf(1, "depth  ticks  cycles/block  commands  avg queue\n");
+  for(depth = 1; depth <= MAXDEPTH; depth *= 2){
+    getkstat(&before);
+    t = uptime();
+    start = rdtsc();
+    if(biobench(n, depth) < 0){
+      printf(2, "biobench: failed\n");
+      exit();
+    }
+    cycles = rdtsc() - start;
+    t = uptime() - t;
+    getkstat(&after);
+
+    subs = after.idesubmits - before.idesubmits;
+    printf(1, "%d  %d  %d  %d  %d\n", depth, t, cycles / n,
+           after.idecmds - before.idecmds,
+           subs ? (after.idedepthsum - before.idedepthsum) / subs : 0);
+  }
+  exit();
+}
@@ -0,0 +1,68 @@
+// A timing variant of forktest.  Measures the average cost of
+// fork+exit+wait and of fork+exec+wait (as sh does for every
+// command) while the parent's memory grows.  With copy-on-write
+// fork the cost should follow page table size, not memory size.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define ROUNDS 20
+
+char *execargv[] = { "forkbench", "-exit", 0 };
+
+// Average cycles for one fork and reap, with the child
+// either exiting at once or exec'ing a trivial program.
+uint
+timefork(int doexec)
+{
+  uint start, total;
+  int i, pid;
+
+  total = 0;
+  for(i = 0; i < ROUNDS; i++){
+    start = rdtsc();
+    pid = fork();
+    if(pid < 0){
+      printf(2, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(doexec)
+        exec(execargv[0], execargv);
+      exit();
+    }
+    wait();
+    total += rdtsc() - start;
+  }
+  return total / ROUNDS;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int sizes[] = { 0, 64*1024, 128*1024, 256*1024 };
+  char *p;
+  int i, grown, n;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+
+  printf(1, "heap KB  fork+exit cycles  fork+exec cycles\n");
+  grown = 0;
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    // Grow the heap and touch it so every page is resident.
+    n = sizes[i] - grown;
+    if(n > 0){
+      if((p = sbrk(n)) == (char*)-1){
+        printf(2, "forkbench: sbrk failed\n");
+        break;
+      }
+      memset(p, 1, n);
+      grown = sizes[i];
+    }
+    printf(1, "%d  %d  %d\n", grown / 1024, timefork(0), timefork(1));
+  }
+  exit();
+}
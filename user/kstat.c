@@ -0,0 +1,58 @@
+#include "types.h"
+#include "stat.h"
+#include "kstat.h"
+#include "user.h"
+
+int
+main()
+{
+  struct kstat ks;
+  if (getkstat(&ks) < 0)
+    exit();
+
+  printf(1, "Timer ticks:         %d\n", ks.ticks);
+  printf(1, "Timer cycles/tick:   %d\n", ks.ticks ? ks.tickcycles / ks.ticks : 0);
+  printf(1, "Timer sleepers:      %d\n", ks.timersleepers);
+  printf(1, "Timer wakeups:       %d\n", ks.timerwakeups);
+  printf(1, "\n");
+  printf(1, "kalloc calls:        %d\n", ks.kallocs);
+  printf(1, "kalloc cache hits:   %d%%\n", ks.kallocs ? ks.kallochits * 100 / ks.kallocs : 0);
+  printf(1, "kfree calls:         %d\n", ks.kfrees);
+  printf(1, "kmem lock acquires:  %d\n", ks.kmemlocks);
+  printf(1, "\n");
+  printf(1, "bcache buffers:      %d\n", ks.bcachebufs);
+  printf(1, "bcache hits:         %d\n", ks.bcachehits);
+  printf(1, "bcache misses:       %d\n", ks.bcachemisses);
+  printf(1, "bcache evictions:    %d\n", ks.bcacheevicts);
+  printf(1, "dirty buffers:       %d\n", ks.dirtybufs);
+  printf(1, "buffers written back: %d\n", ks.flushed);
+  printf(1, "read-ahead blocks:   %d\n", ks.readaheads);
+  printf(1, "read-ahead hits:     %d\n", ks.readaheadhits);
+  printf(1, "\n");
+  printf(1, "blocks allocated:    %d\n", ks.ballocs);
+  printf(1, "bitmap blocks read:  %d\n", ks.bscans);
+  printf(1, "icache inodes:       %d\n", ks.icacheinodes);
+  printf(1, "icache hits:         %d\n", ks.icachehits);
+  printf(1, "icache misses:       %d\n", ks.icachemisses);
+  printf(1, "inodes read:         %d\n", ks.icachereads);
+  printf(1, "dcache hits:         %d (%d negative)\n", ks.dcachehits, ks.dcachenegs);
+  printf(1, "dcache misses:       %d\n", ks.dcachemisses);
+  printf(1, "dcache hit rate:     %d%%\n", ks.dcachehits + ks.dcachemisses ?
+         100 * ks.dcachehits / (ks.dcachehits + ks.dcachemisses) : 0);
+  printf(1, "\n");
+  printf(1, "pipe pages lent:     %d\n", ks.pipeflips);
+  printf(1, "\n");
+  printf(1, "futex waits:         %d\n", ks.futexwaits);
+  printf(1, "futex wakeups:       %d\n", ks.futexwakes);
+  printf(1, "\n");
+  printf(1, "IDE interrupts:      %d\n", ks.ideintrs);
+  printf(1, "IDE commands:        %d\n", ks.idecmds);
+  printf(1, "IDE sectors:         %d\n", ks.idesectors);
+  printf(1, "IDE DMA commands:    %d\n", ks.idedmas);
+  printf(1, "IDE deadline misses: %d\n", ks.idelate);
+  printf(1, "IDE backward seeks:  %d\n", ks.idebackseeks);
+  printf(1, "IDE requests:        %d\n", ks.idesubmits);
+  printf(1, "IDE avg queue depth: %d\n", ks.idesubmits ? ks.idedepthsum / ks.idesubmits : 0);
+
+  exit();
+}
@@ -0,0 +1,73 @@
+// Lock contention benchmark.  Runs 1, 2, 4, ... threads that each
+// take a lock_t a number of times and do a little work while
+// holding it, as T_locks does; reports the time per acquisition
+// and how often threads slept in futex() rather than spinning.
+// An argument sets the acquisitions per thread.
+
+#include "types.h"
+#include "stat.h"
+#include "kstat.h"
+#include "user.h"
+#include "x86.h"
+
+#define LOOPS 1000
+#define MAXTHREADS 32
+
+lock_t lock;
+int loops, global;
+
+void
+worker(void *arg)
+{
+  int i, j, tmp;
+
+  for(i = 0; i < loops; i++){
+    lock_acquire(&lock);
+    tmp = global;
+    for(j = 0; j < 50; j++)
+      ;
+    global = tmp + 1;
+    lock_release(&lock);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  uint start, cycles;
+  int n, i, t;
+
+  loops = LOOPS;
+  if(argc > 1)
+    loops = atoi(argv[1]);
+  lock_init(&lock);
+
+  printf(1, "threads  ticks  cycles/acquire  futex waits\n");
+  for(n = 1; n <= MAXTHREADS; n *= 2){
+    global = 0;
+    getkstat(&before);
+    t = uptime();
+    start = rdtsc();
+    for(i = 0; i < n; i++){
+      if(thread_create(worker, 0) < 0){
+        printf(2, "lockbench: thread_create failed\n");
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      thread_join();
+    cycles = rdtsc() - start;
+    t = uptime() - t;
+    getkstat(&after);
+
+    if(global != n * loops){
+      printf(2, "lockbench: count %d, want %d\n", global, n * loops);
+      exit();
+    }
+    printf(1, "%d  %d  %d  %d\n", n, t, cycles / (n * loops),
+           after.futexwaits - before.futexwaits);
+  }
+  exit();
+}
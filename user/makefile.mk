@@ -1,23 +1,29 @@
 
 # user programs
 USER_PROGS := \
+	biobench\
 	cat\
 	echo\
 	forktest\
+	forkbench\
 	grep\
 	init\
 	kill\
+	kstat\
+	lockbench\
 	ln\
 	ls\
 	mkdir\
 	null\
 	pinfo\
+	pipebench\
 	rm\
 	sh\
 	stressfs\
 	tester\
 	ticket\
 	ticktest\
+	tickbench\
 	usertests\
 	wc\
 	waketest\
@@ -20,6 +20,10 @@ main()
     printf(1, "Pass:            %d\n", stats.pass[i]);
     printf(1, "Times scheduled: %d\n", stats.scheduled[i]);
     printf(1, "CPU Time:        %d\n", stats.ticks[i]);
+    printf(1, "Last CPU:        %d\n", stats.cpu[i]);
+    printf(1, "Migrations:      %d\n", stats.migrated[i]);
+    printf(1, "Size:            %d KB\n", stats.size[i] / 1024);
+    printf(1, "Resident:        %d KB\n", stats.resident[i] * 4);
     printf(1, "------------------------\n");
     printf(1, "\n");
   }
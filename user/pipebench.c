@@ -0,0 +1,76 @@
+// Pipe throughput benchmark.  A child writes through a pipe in
+// chunks of 512 bytes (as cat does) up to four pages, and the
+// parent reads and counts; reports the time per kilobyte for each
+// size and how many pages went through without being copied.
+// Buffers are page-aligned, so whole-page chunks can be lent.
+// An argument sets the total to move, in kilobytes.
+
+#include "types.h"
+#include "stat.h"
+#include "kstat.h"
+#include "user.h"
+#include "x86.h"
+
+#define TOTALKB 4096
+#define MAXCHUNK 16384
+#define PGSIZE 4096
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  uint start, cycles, total, got;
+  int fds[2], chunk, n, t;
+  char *wbuf, *rbuf;
+
+  total = TOTALKB;
+  if(argc > 1)
+    total = atoi(argv[1]);
+  total *= 1024;
+
+  wbuf = sbrk(2*MAXCHUNK + PGSIZE);
+  wbuf = (char*)(((uint)wbuf + PGSIZE - 1) & ~(PGSIZE - 1));
+  rbuf = wbuf + MAXCHUNK;
+  memset(wbuf, 'x', 2*MAXCHUNK);
+
+  printf(1, "chunk  ticks  cycles/KB  pages lent\n");
+  for(chunk = 512; chunk <= MAXCHUNK; chunk *= 2){
+    if(pipe(fds) < 0){
+      printf(2, "pipebench: pipe failed\n");
+      exit();
+    }
+    getkstat(&before);
+    t = uptime();
+    start = rdtsc();
+    n = fork();
+    if(n < 0){
+      printf(2, "pipebench: fork failed\n");
+      exit();
+    }
+    if(n == 0){
+      close(fds[0]);
+      for(got = 0; got < total; got += chunk)
+        if(write(fds[1], wbuf, chunk) != chunk){
+          printf(2, "pipebench: write failed\n");
+          exit();
+        }
+      exit();
+    }
+    close(fds[1]);
+    got = 0;
+    while((n = read(fds[0], rbuf, chunk)) > 0)
+      got += n;
+    close(fds[0]);
+    wait();
+    cycles = rdtsc() - start;
+    t = uptime() - t;
+    getkstat(&after);
+    if(got < total){
+      printf(2, "pipebench: short read\n");
+      exit();
+    }
+    printf(1, "%d  %d  %d  %d\n", chunk, t, cycles / (got / 1024),
+           after.pipeflips - before.pipeflips);
+  }
+  exit();
+}
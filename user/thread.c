@@ -4,6 +4,7 @@
 #include "user.h"
 #include "x86.h"
 #include "param.h"
+#include "futex.h"
 
 int
 thread_create(void(*start_routine)(void*), void* arg)
@@ -30,6 +31,11 @@ thread_join(void)
   return pid;
 }
 
+// Locks sleep rather than spin while held for long.  The lock
+// word is 0 when free, 1 when held and 2 when held with waiters
+// that may be asleep in futex(), whom lock_release must wake.
+#define LOCK_SPINS 100  // tries before sleeping
+
 void
 lock_init(lock_t *lock)
 {
@@ -39,10 +45,29 @@ lock_init(lock_t *lock)
 void
 lock_acquire(lock_t *lock)
 {
-  while(xchg(&lock->locked, 1) != 0);
+  uint c;
+  int i;
+
+  // The holder is likely running on another CPU and about
+  // to let go, so spin for a little while first.
+  for(i = 0; i < LOCK_SPINS; i++){
+    if((c = cmpxchg(&lock->locked, 0, 1)) == 0)
+      return;
+    if(c == 2)
+      break;
+    pause();
+  }
+
+  // Then mark the lock as waited for and sleep until it is
+  // released.  Whoever takes it this way leaves it marked,
+  // since other waiters may still be asleep.
+  while((c = xchg(&lock->locked, 2)) != 0)
+    futex((int*)&lock->locked, FUTEX_WAIT, 2);
 }
 
-void lock_release(lock_t *lock)
+void
+lock_release(lock_t *lock)
 {
-  xchg(&lock->locked, 0);
-}
\ No newline at end of file
+  if(xchg(&lock->locked, 0) == 2)
+    futex((int*)&lock->locked, FUTEX_WAKE, 1);
+}
@@ -0,0 +1,63 @@
+// Measure the cost of the clock tick handler as the number of
+// sleeping processes grows.  With the timer wheel, a sleeper is only
+// touched on the tick its sleep() expires, so the cycles per tick
+// should stay flat no matter how many processes are asleep.
+
+#include "types.h"
+#include "stat.h"
+#include "kstat.h"
+#include "user.h"
+
+#define SAMPLE_TICKS 100
+#define MAX_SLEEPERS 48
+
+int pids[MAX_SLEEPERS];
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat before, after;
+  int n, i, max;
+
+  max = MAX_SLEEPERS;
+  if(argc > 1)
+    max = atoi(argv[1]);
+  if(max > MAX_SLEEPERS)
+    max = MAX_SLEEPERS;
+
+  printf(1, "sleepers  cycles/tick  wakeups\n");
+  for(n = 0; n <= max; n = n ? n * 2 : 1){
+    // Start n children that sleep well past the sample window,
+    // with staggered deadlines so they fill many wheel slots.
+    for(i = 0; i < n; i++){
+      pids[i] = fork();
+      if(pids[i] < 0){
+        printf(2, "tickbench: fork failed\n");
+        n = i;
+        break;
+      }
+      if(pids[i] == 0){
+        sleep(10 * SAMPLE_TICKS + i * 7);
+        exit();
+      }
+    }
+    sleep(5);  // let the children reach sleep()
+
+    if(getkstat(&before) < 0){
+      printf(2, "tickbench: getkstat failed\n");
+      exit();
+    }
+    sleep(SAMPLE_TICKS);
+    getkstat(&after);
+
+    printf(1, "%d  %d  %d\n", after.timersleepers,
+           (after.tickcycles - before.tickcycles) / (after.ticks - before.ticks),
+           after.timerwakeups - before.timerwakeups);
+
+    for(i = 0; i < n; i++)
+      kill(pids[i]);
+    for(i = 0; i < n; i++)
+      wait();
+  }
+  exit();
+}
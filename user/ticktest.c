@@ -110,6 +110,9 @@ main(int argc, char** argv)
 				printf(1, "Tickets:         %d\n", stats.tickets[j]);
 				printf(1, "Times Scheduled: %d\n", stats.scheduled[j]);
 				printf(1, "Ticks:           %d\n", stats.ticks[j]);
+				printf(1, "Per 10 tickets:  %d\n", stats.scheduled[j] * 10 / stats.tickets[j]);
+				printf(1, "Last CPU:        %d\n", stats.cpu[j]);
+				printf(1, "Migrations:      %d\n", stats.migrated[j]);
         printf(1, "\n");
 			}
 		}
@@ -3,6 +3,8 @@
 
 struct stat;
 struct pstat;
+struct kstat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -31,11 +33,22 @@ int getticket(void);
 int getpinfo(struct pstat*);
 int clone(void(*)(void*), void*, void*);
 int join(void**);
+int getkstat(struct kstat*);
+int sync(void);
+int fsync(int);
+int biobench(int, int);
+int sendfile(int, int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int futex(int*, int, int);
 
 // user library functions (ulib.c)
 int stat(char*, struct stat*);
 char* strcpy(char*, char*);
 void *memmove(void*, void*, int);
+int memcmp(const void*, const void*, uint);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void printf(int, char*, ...);
@@ -5,9 +5,14 @@
 #include "fcntl.h"
 #include "syscall.h"
 #include "traps.h"
+#include "pstat.h"
+#include "uio.h"
 
 #define PAGE (4096)
 #define MAX_PROC_MEM (640 * 1024)
+// 512-byte records in writetest1's file: reaches into the
+// double-indirect tree
+#define BIGBLOCKS ((NDIRECT + NINDIRECT + 2) * (BSIZE/512))
 
 char buf[2048];
 char name[3];
@@ -61,6 +66,10 @@ writetest(void)
     }
   }
   printf(stdout, "writes ok\n");
+  if(fsync(fd) < 0){
+    printf(stdout, "error: fsync small failed!\n");
+    exit();
+  }
   close(fd);
   fd = open("small", O_RDONLY);
   if(fd >= 0){
@@ -98,7 +107,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -118,7 +127,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -203,6 +212,198 @@ exectest(void)
 
 // simple fork and pipe read/write
 
+// Whole pages written from and read into page-aligned buffers
+// are lent rather than copied: the writer must still be able to
+// change its buffer without affecting what the reader gets, and
+// the reader must be able to write to what it received.
+void
+pipeflip(void)
+{
+  int fds[2], pid, i, j;
+  char *wbuf, *rbuf;
+
+  printf(1, "pipeflip test\n");
+
+  wbuf = sbrk(3*PAGE);
+  wbuf = (char*)(((uint)wbuf + PAGE - 1) & ~(PAGE - 1));
+  rbuf = wbuf + PAGE;
+  if(pipe(fds) != 0){
+    printf(1, "pipeflip: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < 8; i++){
+      memset(wbuf, i, PAGE);
+      if(write(fds[1], wbuf, PAGE) != PAGE){
+        printf(1, "pipeflip: write failed\n");
+        exit();
+      }
+      memset(wbuf, 0xff, PAGE);  // must not change what was written
+    }
+    exit();
+  } else if(pid < 0){
+    printf(1, "pipeflip: fork failed\n");
+    exit();
+  }
+  close(fds[1]);
+  for(i = 0; i < 8; i++){
+    if(read(fds[0], rbuf, PAGE) != PAGE){
+      printf(1, "pipeflip: short read\n");
+      exit();
+    }
+    for(j = 0; j < PAGE; j++){
+      if(rbuf[j] != (char)i){
+        printf(1, "pipeflip: wrong data in page %d\n", i);
+        exit();
+      }
+    }
+    memset(rbuf, 0xee, PAGE);
+  }
+  close(fds[0]);
+  wait();
+  printf(1, "pipeflip ok\n");
+}
+
+// sendfile from a file into a pipe and from the pipe into
+// another file.
+void
+sendfiletest(void)
+{
+  int fds[2], fd, pid, i, n, tot;
+
+  printf(1, "sendfile test\n");
+
+  fd = open("sf0", O_CREATE|O_RDWR);
+  for(i = 0; i < 10; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "sendfile: write sf0 failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(1, "sendfile: pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("sf0", 0);
+    if(sendfile(fds[1], fd, -1, 10*sizeof(buf)) != 10*sizeof(buf)){
+      printf(1, "sendfile: file to pipe failed\n");
+      exit();
+    }
+    if(sendfile(fds[1], fd, -1, 1) != 0){
+      printf(1, "sendfile: no eof\n");
+      exit();
+    }
+    exit();
+  } else if(pid < 0){
+    printf(1, "sendfile: fork failed\n");
+    exit();
+  }
+  close(fds[1]);
+  fd = open("sf1", O_CREATE|O_RDWR);
+  tot = 0;
+  while((n = sendfile(fd, fds[0], -1, 5000)) > 0)
+    tot += n;
+  close(fds[0]);
+  close(fd);
+  wait();
+  if(n < 0 || tot != 10*sizeof(buf)){
+    printf(1, "sendfile: pipe to file moved %d\n", tot);
+    exit();
+  }
+
+  fd = open("sf1", 0);
+  for(i = 0; i < 10; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "sendfile: short sf1\n");
+      exit();
+    }
+    for(n = 0; n < sizeof(buf); n++){
+      if(buf[n] != 'a' + i){
+        printf(1, "sendfile: wrong data\n");
+        exit();
+      }
+    }
+  }
+  close(fd);
+  unlink("sf0");
+  unlink("sf1");
+  printf(1, "sendfile ok\n");
+}
+
+// pread and pwrite leave the file offset alone; writev and
+// readv fill and empty their buffers in order.
+void
+preadtest(void)
+{
+  int fd, i;
+  char a[4], b[6], c[8];
+  struct iovec iov[3];
+
+  printf(1, "pread test\n");
+
+  fd = open("pr0", O_CREATE|O_RDWR);
+  iov[0].iov_base = "abcd";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = "efghij";
+  iov[1].iov_len = 6;
+  iov[2].iov_base = "klmnopqr";
+  iov[2].iov_len = 8;
+  if(writev(fd, iov, 3) != 18){
+    printf(1, "pread: writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 4) != 2){
+    printf(1, "pread: pwrite failed\n");
+    exit();
+  }
+  if(pread(fd, buf, 3, 3) != 3 || memcmp(buf, "dXY", 3) != 0){
+    printf(1, "pread: pread got wrong data\n");
+    exit();
+  }
+  if(pread(fd, buf, 10, 15) != 3 || pread(fd, buf, 10, 18) != 0){
+    printf(1, "pread: pread past end\n");
+    exit();
+  }
+  // The offset is still at the end of the writev.
+  if(write(fd, "s", 1) != 1){
+    printf(1, "pread: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("pr0", 0);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+  if((i = readv(fd, iov, 3)) != 18){
+    printf(1, "pread: readv returned %d\n", i);
+    exit();
+  }
+  if(memcmp(a, "abcd", 4) != 0 || memcmp(b, "XYghij", 6) != 0 ||
+     memcmp(c, "klmnopqr", 8) != 0){
+    printf(1, "pread: readv got wrong data\n");
+    exit();
+  }
+  if(readv(fd, iov, 3) != 1 || a[0] != 's' || readv(fd, iov, 3) != 0){
+    printf(1, "pread: readv at end\n");
+    exit();
+  }
+  close(fd);
+  unlink("pr0");
+  printf(1, "pread ok\n");
+}
+
 void
 pipe1(void)
 {
@@ -1026,6 +1227,119 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// Two files grown a block at a time, each reopened for every
+// block: their preallocated blocks must stay private and must go
+// back to the free map on close, or the disk runs out of blocks.
+void
+prealloctest(void)
+{
+  int fd[2], i, j, k, n;
+  char *names[2] = { "prealloc0", "prealloc1" };
+
+  printf(1, "prealloc test\n");
+
+  for(i = 0; i < 60; i++){
+    for(j = 0; j < 2; j++){
+      fd[j] = open(names[j], O_CREATE | O_RDWR);
+      if(fd[j] < 0){
+        printf(1, "prealloc: cannot open %s\n", names[j]);
+        exit();
+      }
+      for(k = 0; k < i; k++){
+        if(read(fd[j], buf, 512) != 512){
+          printf(1, "prealloc: short read\n");
+          exit();
+        }
+      }
+    }
+    for(j = 0; j < 2; j++){
+      memset(buf, 2*i+j, 512);
+      if(write(fd[j], buf, 512) != 512){
+        printf(1, "prealloc: write failed\n");
+        exit();
+      }
+      close(fd[j]);
+    }
+  }
+
+  for(j = 0; j < 2; j++){
+    fd[j] = open(names[j], 0);
+    for(i = 0; (n = read(fd[j], buf, 512)) == 512; i++){
+      if(buf[0] != (char)(2*i+j) || buf[511] != (char)(2*i+j)){
+        printf(1, "prealloc: wrong data\n");
+        exit();
+      }
+    }
+    if(n != 0 || i != 60){
+      printf(1, "prealloc: wrong size\n");
+      exit();
+    }
+    close(fd[j]);
+    unlink(names[j]);
+  }
+
+  printf(1, "prealloc test ok\n");
+}
+
+// The name cache must follow creates and unlinks, and must not
+// carry a removed directory's names over to a new one.
+void
+dcachetest(void)
+{
+  int fd, i;
+
+  printf(1, "dcache test\n");
+
+  for(i = 0; i < 2; i++){
+    if(mkdir("dc") < 0){
+      printf(1, "dcache: mkdir dc failed\n");
+      exit();
+    }
+    if(open("dc/f", 0) >= 0){
+      printf(1, "dcache: dc/f exists before create\n");
+      exit();
+    }
+    if(open("dc/f", 0) >= 0){
+      printf(1, "dcache: dc/f exists on second lookup\n");
+      exit();
+    }
+    fd = open("dc/f", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(1, "dcache: create dc/f failed\n");
+      exit();
+    }
+    close(fd);
+    if((fd = open("dc/f", 0)) < 0){
+      printf(1, "dcache: dc/f missing after create\n");
+      exit();
+    }
+    close(fd);
+    if(link("dc/f", "dc/g") < 0 || unlink("dc/f") < 0){
+      printf(1, "dcache: link or unlink failed\n");
+      exit();
+    }
+    if(open("dc/f", 0) >= 0){
+      printf(1, "dcache: dc/f exists after unlink\n");
+      exit();
+    }
+    if((fd = open("dc/g", 0)) < 0){
+      printf(1, "dcache: dc/g missing after link\n");
+      exit();
+    }
+    close(fd);
+    if(unlink("dc/g") < 0 || unlink("dc") < 0){
+      printf(1, "dcache: cleanup failed\n");
+      exit();
+    }
+    if(open("dc/g", 0) >= 0){
+      printf(1, "dcache: dc/g exists after rmdir\n");
+      exit();
+    }
+  }
+
+  printf(1, "dcache test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1394,6 +1708,95 @@ sbrktest(void)
   printf(stdout, "sbrk test OK\n");
 }
 
+// Resident pages of the calling process, from getpinfo().
+int
+resident(void)
+{
+  static struct pstat stats;
+  int i, pid;
+
+  pid = getpid();
+  if(getpinfo(&stats) < 0)
+    return -1;
+  for(i = 0; i < NPROC; i++)
+    if(stats.inuse[i] && stats.pid[i] == pid)
+      return stats.resident[i];
+  return -1;
+}
+
+// sbrk() only reserves address space; pages should be allocated
+// and zeroed on first touch, from user space or from the kernel.
+void
+lazysbrktest(void)
+{
+  char *a, *oldbrk;
+  int fds[2], i, pid, before;
+  uint amt;
+
+  printf(stdout, "lazy sbrk test\n");
+  oldbrk = sbrk(0);
+  before = resident();
+  amt = 64 * PAGE;
+  a = sbrk(amt);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk failed\n");
+    exit();
+  }
+  if(resident() != before){
+    printf(stdout, "lazy sbrk allocated pages, %d -> %d\n", before, resident());
+    exit();
+  }
+
+  // untouched pages read as zero, and only touched pages count
+  for(i = 0; i < amt; i += 8 * PAGE){
+    if(a[i] != 0){
+      printf(stdout, "lazy sbrk page not zeroed at %x\n", a + i);
+      exit();
+    }
+    a[i] = 1;
+  }
+  if(resident() != before + 8){
+    printf(stdout, "lazy sbrk resident %d, expected %d\n", resident(), before + 8);
+    exit();
+  }
+
+  // the kernel writes into untouched pages on the process's behalf
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "lazy", 4);
+  if(read(fds[0], a + PAGE, 4) != 4 || a[PAGE] != 'l' || a[PAGE+3] != 'y'){
+    printf(stdout, "lazy sbrk read() into untouched page failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // a child inherits touched pages and the untouched reservation
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[0] != 1 || a[2 * PAGE] != 0 || a[amt - 1] != 0){
+      printf(stdout, "lazy sbrk child sees wrong contents\n");
+      exit();
+    }
+    a[amt - 1] = 2;
+    exit();
+  }
+  wait();
+  if(a[amt - 1] != 0){
+    printf(stdout, "lazy sbrk child write visible in parent\n");
+    exit();
+  }
+
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "lazy sbrk test OK\n");
+}
+
 void
 validateint(int *p)
 {
@@ -1493,6 +1896,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazysbrktest();
   validatetest();
 
   opentest();
@@ -1502,12 +1906,17 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipeflip();
+  sendfiletest();
+  preadtest();
   preempt();
   exitwait();
 
   rmdot();
   fourteen();
   bigfile();
+  prealloctest();
+  dcachetest();
   subdir();
   concreate();
   linktest();